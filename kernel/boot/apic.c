@@ -0,0 +1,150 @@
+#include <alien/apic.h>
+#include <alien/timer.h>
+#include <alien/kernel.h>
+#include <alien/memory/vmalloc.h>
+#include <alien/memory/paging.h>
+
+#define MSR_APIC_BASE			0x1B
+#define APIC_BASE_ENABLE		(1 << 11)
+#define APIC_BASE_ADDR(msr)		((u32) (msr) & 0xFFFFF000)
+
+#define CPUID_FEAT_EDX_APIC		(1 << 9)
+
+/* Register offsets */
+#define LAPIC_ID				0x020
+#define LAPIC_EOI				0x0B0
+#define LAPIC_SVR				0x0F0
+#define LAPIC_ICR_LOW			0x300
+#define LAPIC_ICR_HIGH			0x310
+#define LAPIC_LVT_TIMER			0x320
+#define LAPIC_TIMER_INITIAL		0x380
+#define LAPIC_TIMER_CURRENT		0x390
+#define LAPIC_TIMER_DIVIDE		0x3E0
+
+#define LAPIC_SVR_ENABLE		(1 << 8)
+#define LAPIC_LVT_MASKED		(1 << 16)
+#define LAPIC_DIVIDE_16			0x3
+
+#define ICR_INIT				0x00000500
+#define ICR_STARTUP				0x00000600
+#define ICR_DELIVERY_PENDING	(1 << 12)
+#define ICR_ASSERT				(1 << 14)
+
+#define CALIBRATION_MS			10
+
+static volatile u32 *lapic = 0;
+
+u32 lapic_ticks_per_jiffy = 0;
+
+static inline u32
+lapic_read(u32 reg)
+{
+	return lapic[reg / 4];
+}
+
+static inline void
+lapic_write(u32 reg, u32 value)
+{
+	lapic[reg / 4] = value;
+}
+
+static void
+lapic_calibrate()
+{
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+	
+	pit_delay_ms(CALIBRATION_MS);
+	
+	u32 elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+	lapic_write(LAPIC_TIMER_INITIAL, 0);
+	
+	lapic_ticks_per_jiffy = elapsed / CALIBRATION_MS * 1000 / HZ;
+}
+
+int
+lapic_init()
+{
+	u32 eax, ebx, ecx, edx;
+	
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_FEAT_EDX_APIC))
+		return -1;
+	
+	u64 base = rdmsr(MSR_APIC_BASE);
+	
+	lapic = (volatile u32 *) ioremap(APIC_BASE_ADDR(base), PAGE_SIZE);
+	if (!lapic)
+		return -1;
+	
+	wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+	
+	lapic_calibrate();
+	
+	if (lapic_ticks_per_jiffy == 0)
+		return -1;
+	
+	/* One-shot mode */
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+	
+	return 0;
+}
+
+void
+lapic_enable()
+{
+	/* Every CPU sees its own local APIC at the address mapped by the BSP */
+	wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+	lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+	lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+}
+
+u8
+lapic_id()
+{
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+static void
+lapic_send_icr(u8 apic_id, u32 command)
+{
+	while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING) {
+		asm volatile ("pause");
+	}
+	
+	lapic_write(LAPIC_ICR_HIGH, (u32) apic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, command);
+}
+
+void
+lapic_send_ipi(u8 apic_id, u8 vector)
+{
+	lapic_send_icr(apic_id, ICR_ASSERT | vector);
+}
+
+void
+lapic_send_init(u8 apic_id)
+{
+	lapic_send_icr(apic_id, ICR_ASSERT | ICR_INIT);
+}
+
+void
+lapic_send_startup(u8 apic_id, u32 page)
+{
+	lapic_send_icr(apic_id, ICR_ASSERT | ICR_STARTUP | (page >> 12));
+}
+
+void
+lapic_eoi()
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+void
+lapic_timer_oneshot(u32 count)
+{
+	lapic_write(LAPIC_TIMER_INITIAL, count);
+}
@@ -0,0 +1,256 @@
+#include <alien/fpu.h>
+#include <alien/task.h>
+#include <alien/kernel.h>
+#include <alien/string.h>
+#include <alien/memory/kmalloc.h>
+#include <alien/memory/paging.h>
+
+#define CR0_MP				(1 << 1)
+#define CR0_EM				(1 << 2)
+#define CR0_TS				(1 << 3)
+#define CR0_NE				(1 << 5)
+#define CR4_OSFXSR			(1 << 9)
+#define CR4_OSXMMEXCPT		(1 << 10)
+
+#define CPUID_FEAT_EDX_FXSR	(1 << 24)
+#define CPUID_FEAT_EDX_SSE	(1 << 25)
+
+#define MXCSR_DEFAULT		0x1F80	/* All exceptions masked */
+
+static u8 fpu_present = 0;
+
+/* State of a task which never used the FPU */
+static struct fpu_state fpu_init_state;
+
+static inline u32
+read_cr0()
+{
+	u32 cr0;
+	asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+	return cr0;
+}
+
+static inline void
+write_cr0(u32 cr0)
+{
+	asm volatile ("mov %0, %%cr0" :: "r" (cr0));
+}
+
+static inline u32
+read_cr4()
+{
+	u32 cr4;
+	asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+	return cr4;
+}
+
+static inline void
+write_cr4(u32 cr4)
+{
+	asm volatile ("mov %0, %%cr4" :: "r" (cr4));
+}
+
+/* FPU instructions trap to fpu_trap() */
+static inline void
+stts()
+{
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void
+clts()
+{
+	asm volatile ("clts");
+}
+
+static inline void
+fxsave(struct fpu_state *state)
+{
+	asm volatile ("fxsave %0" : "=m" (*state));
+}
+
+static inline void
+fxrstor(const struct fpu_state *state)
+{
+	asm volatile ("fxrstor %0" :: "m" (*state));
+}
+
+/* Save the registers of @task if it changed them since they were loaded */
+static void
+fpu_save(task_header_t *task)
+{
+	if (this_cpu()->fpu_owner == task && !(read_cr0() & CR0_TS)) {
+		fxsave(task->fpu);
+	}
+}
+
+int
+fpu_init()
+{
+	u32 eax, ebx, ecx, edx;
+	u32 mxcsr = MXCSR_DEFAULT;
+	
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID_FEAT_EDX_FXSR) || !(edx & CPUID_FEAT_EDX_SSE)) {
+		kprintf("[ERROR] No FXSAVE or SSE support, FPU disabled\n");
+		write_cr0(read_cr0() | CR0_EM);
+		return -1;
+	}
+	
+	write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+	write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	
+	asm volatile ("fninit");
+	asm volatile ("ldmxcsr %0" :: "m" (mxcsr));
+	/* The APs only need their control registers set */
+	if (!fpu_present) {
+		fxsave(&fpu_init_state);
+	}
+	
+	fpu_present = 1;
+	stts();
+	
+	return 0;
+}
+
+void
+fpu_switch(task_header_t *prev, task_header_t *next)
+{
+	struct cpu *cpu = this_cpu();
+	
+	if (!fpu_present) {
+		return;
+	}
+	
+	/* @prev may run on another CPU next, its state must be in memory. The
+	 * registers still hold it, so loading them again is only needed if
+	 * another task used them, or @next ran elsewhere meanwhile */
+	fpu_save(prev);
+	
+	if (next == cpu->fpu_owner && next->fpu_cpu == cpu) {
+		clts();
+	} else {
+		stts();
+	}
+}
+
+void
+fpu_trap()
+{
+	task_header_t *task = current_task;
+	
+	if (!fpu_present) {
+		kprintf("[ERROR] FPU instruction without FPU support, pid %d\n",
+				task->info.pid);
+		task_exit();
+	}
+	
+	if (!task->fpu) {
+		task->fpu = (struct fpu_state *) kmalloc_aligned(sizeof(struct fpu_state),
+														 FPU_STATE_ALIGN);
+		if (!task->fpu) {
+			kprintf("[ERROR] No memory for the FPU state of pid %d\n",
+					task->info.pid);
+			task_exit();
+		}
+		
+		memcpy(task->fpu, &fpu_init_state, sizeof(struct fpu_state));
+	}
+	
+	/* The state of the previous owner was saved when it was switched out */
+	clts();
+	fxrstor(task->fpu);
+	
+	this_cpu()->fpu_owner = task;
+	task->fpu_cpu = this_cpu();
+}
+
+int
+fpu_fork(task_header_t *parent, task_header_t *child)
+{
+	child->fpu = 0;
+	child->fpu_cpu = 0;
+	
+	if (!parent->fpu) {
+		return 0;
+	}
+	
+	child->fpu = (struct fpu_state *) kmalloc_aligned(sizeof(struct fpu_state),
+													  FPU_STATE_ALIGN);
+	if (!child->fpu) {
+		return -1;
+	}
+	
+	u32 flags = irq_save();
+	
+	fpu_save(parent);
+	memcpy(child->fpu, parent->fpu, sizeof(struct fpu_state));
+	irq_restore(flags);
+	
+	return 0;
+}
+
+void
+fpu_release(task_header_t *task)
+{
+	if (this_cpu()->fpu_owner == task) {
+		this_cpu()->fpu_owner = 0;
+		
+		if (fpu_present) {
+			stts();
+		}
+	}
+	
+	if (task->fpu) {
+		kfree(task->fpu);
+		task->fpu = 0;
+	}
+}
+
+void
+kernel_fpu_begin()
+{
+	u32 flags = irq_save();
+	struct cpu *cpu = this_cpu();
+	
+	if (cpu->fpu_owner) {
+		fpu_save(cpu->fpu_owner);
+		cpu->fpu_owner = 0;
+	}
+	
+	clts();
+	cpu->kernel_fpu_flags = flags;
+}
+
+void
+kernel_fpu_end()
+{
+	stts();
+	irq_restore(this_cpu()->kernel_fpu_flags);
+}
+
+void
+copy_page(void *dest, const void *src)
+{
+	if (!fpu_present) {
+		memcpy(dest, src, PAGE_SIZE);
+		return;
+	}
+	
+	kernel_fpu_begin();
+	
+	for (u32 i = 0; i < PAGE_SIZE; i += 64) {
+		asm volatile ("movaps 0(%1), %%xmm0\n\t"
+					  "movaps 16(%1), %%xmm1\n\t"
+					  "movaps 32(%1), %%xmm2\n\t"
+					  "movaps 48(%1), %%xmm3\n\t"
+					  "movaps %%xmm0, 0(%0)\n\t"
+					  "movaps %%xmm1, 16(%0)\n\t"
+					  "movaps %%xmm2, 32(%0)\n\t"
+					  "movaps %%xmm3, 48(%0)"
+					  :: "r" ((u8 *) dest + i), "r" ((const u8 *) src + i)
+					  : "memory");
+	}
+	
+	kernel_fpu_end();
+}
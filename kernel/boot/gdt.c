@@ -1,11 +1,19 @@
 #include "gdt.h"
 #include <alien/io.h>
+#include <alien/smp.h>
+#include <alien/string.h>
 
-#define GDT_SIZE 6
+#define GDT_SIZE 7
+
+#define GDT_TSS 5
+#define GDT_CPU 6
 
 /* Defined in gdt_asm.asm */
 extern void gdt_flush(u32 gp);
 
+/* Defined in task_asm.asm */
+extern void tss_flush(u32 index);
+
 struct gdt_entry
 {
     u16 limit_low;
@@ -23,17 +31,14 @@ struct gdt_ptr
 } __attribute__((packed));
 
 
-static struct gdt_entry gdt[GDT_SIZE];
-static struct gdt_ptr gp;
+/* Each CPU has its own GDT, only the TSS and CPU_SEL entries differ */
+static struct gdt_entry gdts[MAX_CPUS][GDT_SIZE];
+static struct gdt_ptr gps[MAX_CPUS];
+static struct tss_entry tss[MAX_CPUS];
 
-void
-gdt_set_gate(u32 num, u32 base, u32 limit, u8 access, u8 gran)
+static void
+set_gate(struct gdt_entry *gdt, u32 num, u32 base, u32 limit, u8 access, u8 gran)
 {
-    if (num >= GDT_SIZE) {
-        kputs("[ERROR] gdt_set_gate: Can't set gdt gate above size.\n");
-        return;
-    }
-
     gdt[num].base_low = (base & 0xFFFF);
     gdt[num].base_middle = (base >> 16) & 0xFF;
     gdt[num].base_high = (base >> 24) & 0xFF;
@@ -46,16 +51,53 @@ gdt_set_gate(u32 num, u32 base, u32 limit, u8 access, u8 gran)
 }
 
 void
-gdt_install()
+gdt_set_gate(u32 num, u32 base, u32 limit, u8 access, u8 gran)
+{
+    if (num >= GDT_SIZE) {
+        kputs("[ERROR] gdt_set_gate: Can't set gdt gate above size.\n");
+        return;
+    }
+
+    set_gate(gdts[this_cpu()->id], num, base, limit, access, gran);
+}
+
+void
+gdt_install_cpu(struct cpu *cpu)
 {
-    gdt_set_gate(0, 0, 0, 0, 0);
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
+    u32 id = cpu - cpus;
+    struct gdt_entry *gdt = gdts[id];
+
+    cpu->self = cpu;
+    cpu->id = id;
+
+    memset(&tss[id], 0, sizeof(struct tss_entry));
+    tss[id].ss0 = K_DATA_SEL;
+    tss[id].cs = K_CODE_SEL;
+
+    set_gate(gdt, 0, 0, 0, 0, 0);
+    set_gate(gdt, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    set_gate(gdt, 2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+    set_gate(gdt, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
+    set_gate(gdt, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
+    set_gate(gdt, GDT_TSS, (u32) &tss[id], sizeof(struct tss_entry) - 1, 0xE9, 0xCF);
+    set_gate(gdt, GDT_CPU, (u32) cpu, sizeof(struct cpu) - 1, 0x92, 0x40);
+
+    gps[id].base = (u32) gdt;
+    gps[id].limit = GDT_SIZE * sizeof(struct gdt_entry) - 1;
 
-    gp.base = (u32) gdt;
-    gp.limit = GDT_SIZE * sizeof(struct gdt_entry) - 1;
+    gdt_flush((u32) &gps[id]);
+    asm volatile ("mov %0, %%gs" :: "r" (CPU_SEL));
+    tss_flush(GDT_TSS * 8 | 3);
+}
+
+void
+gdt_install()
+{
+    gdt_install_cpu(boot_cpu());
+}
 
-    gdt_flush((u32) &gp);
+void
+tss_set_esp0(u32 esp0)
+{
+    tss[this_cpu()->id].esp0 = esp0;
 }
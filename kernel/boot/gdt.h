@@ -3,6 +3,8 @@
 
 #include <types.h>
 
+struct cpu;
+
 #define K_CODE_SEL 0x08
 #define K_DATA_SEL 0x10
 #define U_CODE_SEL 0x18
@@ -51,13 +53,25 @@ struct tss_entry
 void gdt_set_gate(u32 num, u32 base, u32 limit, u8 access, u8 gran);
 
 /**
- * Install the gdt with 5 segment descriptors :
+ * Install the gdt of the boot processor with 7 segment descriptors :
  *      0 : 0x00 - null descriptor
  *      1 : 0x08 - kernel code segment descriptor
  *      2 : 0x10 - kernel data segment descriptor
  *      3 : 0x18 - user code segment descriptor
  *      4 : 0x20 - user data segment descriptor
+ *      5 : 0x28 - TSS of the CPU
+ *      6 : 0x30 - per-CPU data, loaded in GS (see smp.h)
  */
 void gdt_install();
 
+/**
+ * Install the gdt and TSS of @cpu, on that CPU.
+ */
+void gdt_install_cpu(struct cpu *cpu);
+
+/**
+ * Set the kernel stack used when this CPU enters the kernel from user mode.
+ */
+void tss_set_esp0(u32 esp0);
+
 #endif
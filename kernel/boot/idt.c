@@ -4,6 +4,22 @@
 #include <alien/kernel.h>
 #include <alien/io.h>
 #include <alien/task.h>
+#include <alien/sched.h>
+#include <alien/timer.h>
+#include <alien/apic.h>
+#include <alien/fpu.h>
+#include <alien/smp.h>
+#include <alien/preempt.h>
+#include <alien/softirq.h>
+#include <alien/profile.h>
+#include <alien/syscall.h>
+#include <alien/string.h>
+#include <alien/memory/kmalloc.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/shm.h>
+#include <alien/memory/vm.h>
+#include <alien/memory/uffd.h>
+#include <alien/vfs.h>
 
 #define MASTER_IRQ_COMMAND  0x20
 #define MASTER_IRQ_DATA     0x21
@@ -63,6 +79,10 @@ extern void isr45();
 extern void isr46();
 extern void isr47();
 
+extern void isr48();
+extern void isr49();
+extern void isr63();
+
 extern void isr100();
 
 struct idt_entry
@@ -162,6 +182,10 @@ idt_install()
     idt_set_gate(46, (u32) isr46, K_CODE_SEL, IDT_EF_P | IDT_EF_INT);
     idt_set_gate(47, (u32) isr47, K_CODE_SEL, IDT_EF_P | IDT_EF_INT);
 
+    idt_set_gate(LAPIC_TIMER_VECTOR, (u32) isr48, K_CODE_SEL, IDT_EF_P | IDT_EF_INT);
+    idt_set_gate(LAPIC_RESCHED_VECTOR, (u32) isr49, K_CODE_SEL, IDT_EF_P | IDT_EF_INT);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (u32) isr63, K_CODE_SEL, IDT_EF_P | IDT_EF_INT);
+
     outb(MASTER_IRQ_COMMAND, 0x11);     /* initialize master IRQ */
     outb(SLAVE_IRQ_COMMAND, 0x11);      /* initialize slave IRQ */
     outb(MASTER_IRQ_DATA, 0x20);        /* vector offset */
@@ -174,7 +198,7 @@ idt_install()
     outb(MASTER_IRQ_DATA, 0xFF);
     outb(SLAVE_IRQ_DATA, 0xFF);
     
-    idt_set_gate(100, (u32) isr100, K_CODE_SEL, IDT_EF_P | IDT_EF_INT | IDT_EF_U);
+    idt_set_gate(SYSCALL_VECTOR, (u32) isr100, K_CODE_SEL, IDT_EF_P | IDT_EF_INT | IDT_EF_U);
 
     ip.base = (u32) idt;
     ip.limit = sizeof (struct idt_entry) * IDT_SIZE - 1;
@@ -183,43 +207,387 @@ idt_install()
     asm("sti");
 }
 
+void
+idt_load()
+{
+    idt_flush((u32) &ip);
+}
+
+static inline u32
+read_cr2()
+{
+	u32 cr2;
+	asm volatile ("mov %%cr2, %0" : "=r" (cr2));
+	return cr2;
+}
+
+static int
+copy_user_string(char *dest, u32 src, u32 max)
+{
+	for (u32 i = 0; i < max; i++) {
+		/* Check each page before reading it */
+		if ((i == 0 || (src + i) % PAGE_SIZE == 0) &&
+			vm_prefault(src + i, 1, 0) < 0) {
+			return -1;
+		}
+		
+		dest[i] = ((const char *) src)[i];
+		if (dest[i] == '\0') {
+			return 0;
+		}
+	}
+	
+	return -1;
+}
+
+static i32
+sys_mmap(u32 addr, u32 len, u32 path_ptr)
+{
+	if (path_ptr == 0) {
+		return vm_map(addr, len, 0, 0);
+	}
+	
+	char *path = arena_alloc(&current_task->scratch, PATH_MAX);
+	vfs_node_t *node = arena_alloc(&current_task->scratch, sizeof(vfs_node_t));
+	
+	if (!path || !node || copy_user_string(path, path_ptr, PATH_MAX) < 0 ||
+		vfs_find(0, path, node) < 0) {
+		return -1;
+	}
+	
+	return vm_map(addr, len, node, 0);
+}
+
+static i32
+sys_uffd_read(int id, u32 buf)
+{
+	struct uffd_event event;
+	
+	if (vm_prefault(buf, sizeof(struct uffd_event), 1) < 0 ||
+		uffd_read(id, &event) < 0) {
+		return -1;
+	}
+	
+	memcpy((void *) buf, &event, sizeof(struct uffd_event));
+	
+	return 0;
+}
+
+static i32
+sys_nanosleep(u32 sec, u32 nsec)
+{
+	if (nsec >= 1000000000 || sec > 0xFFFFFFFF / HZ - 1) {
+		return -1;
+	}
+	
+	sleep_ticks(sec * HZ + updiv(nsec, 1000000000 / HZ));
+	
+	return 0;
+}
+
+static i32
+sys_times(u32 buf)
+{
+	struct task_times times;
+	
+	if (vm_prefault(buf, sizeof(struct task_times), 1) < 0) {
+		return -1;
+	}
+	
+	task_times(&times);
+	memcpy((void *) buf, &times, sizeof(struct task_times));
+	
+	return 0;
+}
+
+static i32
+sys_sched_deadline(u32 buf)
+{
+	struct sched_dl_attr attr;
+	
+	if (vm_prefault(buf, sizeof(struct sched_dl_attr), 0) < 0) {
+		return -1;
+	}
+	
+	memcpy(&attr, (void *) buf, sizeof(struct sched_dl_attr));
+	
+	return sched_set_deadline(&attr);
+}
+
+static i32
+sys_dl_stats(u32 buf)
+{
+	struct sched_dl_stats stats;
+	
+	if (vm_prefault(buf, sizeof(struct sched_dl_stats), 1) < 0) {
+		return -1;
+	}
+	
+	sched_dl_stats(current_task, &stats);
+	memcpy((void *) buf, &stats, sizeof(struct sched_dl_stats));
+	
+	return 0;
+}
+
+static i32
+sys_irq_stats(u32 vector, u32 buf)
+{
+	struct irq_stats stats;
+	
+	if (vm_prefault(buf, sizeof(struct irq_stats), 1) < 0 ||
+		irq_get_stats(vector, &stats) < 0) {
+		return -1;
+	}
+	
+	memcpy((void *) buf, &stats, sizeof(struct irq_stats));
+	
+	return 0;
+}
+
+static i32
+sys_sched_trace(u32 buf, u32 count)
+{
+	if (count > SCHED_TRACE_SIZE + 1 ||
+		vm_prefault(buf, count * sizeof(struct sched_event), 1) < 0) {
+		return -1;
+	}
+	
+	/* The trace is read with interrupts disabled, user pages may fault */
+	struct sched_event *events = arena_alloc(&current_task->scratch,
+											 count * sizeof(struct sched_event));
+	if (count && !events) {
+		return -1;
+	}
+	
+	u32 n = sched_trace_read(events, count);
+	
+	memcpy((void *) buf, events, n * sizeof(struct sched_event));
+	
+	return n;
+}
+
+static i32
+sys_sched_hist(u32 pid, u32 buf)
+{
+	task_header_t *task = pid ? task_find_own(pid) : current_task;
+	
+	if (!task || vm_prefault(buf, sizeof(struct sched_hist), 1) < 0) {
+		return -1;
+	}
+	
+	memcpy((void *) buf, &task->hist, sizeof(struct sched_hist));
+	
+	return 0;
+}
+
+static i32
+sys_profile(u32 command, u32 arg)
+{
+	switch (command) {
+	case PROFILE_START:
+		return profile_start(arg);
+	case PROFILE_STOP:
+		profile_stop();
+		return 0;
+	case PROFILE_DUMP:
+		profile_dump();
+		return 0;
+	}
+	
+	return -1;
+}
+
 static void
-syscall_handler(u32 ds, interrupt_frame_t frame)
+syscall_handler(interrupt_frame_t *frame)
 {
-    if (frame.regs.eax == 0x00) {
-		kprintf("%d\n", frame.regs.ebx);
-	} else if (frame.regs.eax == 0x01) {
-		fork(frame);
-	} else {
+	char name[SHM_NAME_MAX];
+	regs_t *r = &frame->regs;
+	
+	/* Handlers may not return, so the scratch space of the previous call is
+	 * dropped here rather than on exit */
+	arena_reset(&current_task->scratch);
+	
+	switch (r->eax) {
+	case SYS_PRINT:
+		kprintf("%d\n", r->ebx);
+		break;
+	case SYS_FORK:
+		r->eax = fork(frame);
+		break;
+	case SYS_SHM_OPEN:
+		if (copy_user_string(name, r->ebx, SHM_NAME_MAX) < 0)
+			r->eax = -1;
+		else
+			r->eax = shm_open(name, r->ecx);
+		break;
+	case SYS_SHM_ATTACH:
+		r->eax = shm_attach(r->ebx, r->ecx);
+		break;
+	case SYS_SHM_DETACH:
+		r->eax = shm_detach(r->ebx, r->ecx);
+		break;
+	case SYS_SHM_UNLINK:
+		if (copy_user_string(name, r->ebx, SHM_NAME_MAX) < 0)
+			r->eax = -1;
+		else
+			r->eax = shm_unlink(name);
+		break;
+	case SYS_EXIT:
+		task_exit();
+		break;
+	case SYS_MMAP:
+		r->eax = sys_mmap(r->ebx, r->ecx, r->edx);
+		break;
+	case SYS_MUNMAP:
+		r->eax = vm_unmap(r->ebx, r->ecx);
+		break;
+	case SYS_MADVISE:
+		r->eax = vm_madvise(r->ebx, r->ecx, r->edx);
+		break;
+	case SYS_UFFD_CREATE:
+		r->eax = uffd_create();
+		break;
+	case SYS_UFFD_REGISTER:
+		r->eax = uffd_register(r->ebx, r->ecx, r->edx);
+		break;
+	case SYS_UFFD_READ:
+		r->eax = sys_uffd_read(r->ebx, r->ecx);
+		break;
+	case SYS_UFFD_COPY:
+		r->eax = uffd_copy(r->ebx, r->ecx, r->edx);
+		break;
+	case SYS_SETPRIO:
+		r->eax = sched_set_priority(current_task, r->ebx);
+		break;
+	case SYS_NANOSLEEP:
+		r->eax = sys_nanosleep(r->ebx, r->ecx);
+		break;
+	case SYS_TIMES:
+		r->eax = sys_times(r->ebx);
+		break;
+	case SYS_SCHED_DEADLINE:
+		r->eax = sys_sched_deadline(r->ebx);
+		break;
+	case SYS_DL_STATS:
+		r->eax = sys_dl_stats(r->ebx);
+		break;
+	case SYS_IRQ_STATS:
+		r->eax = sys_irq_stats(r->ebx, r->ecx);
+		break;
+	case SYS_PROFILE:
+		r->eax = sys_profile(r->ebx, r->ecx);
+		break;
+	case SYS_SCHED_TRACE:
+		r->eax = sys_sched_trace(r->ebx, r->ecx);
+		break;
+	case SYS_SCHED_HIST:
+		r->eax = sys_sched_hist(r->ebx, r->ecx);
+		break;
+	default:
 		kprintf("unknown syscall!\n");
 	}
 }
 
-void
-interrupt_handler(u32 ds, interrupt_frame_t frame)
+static void
+handle_interrupt(interrupt_frame_t *frame)
 {
-	if (frame.int_no < 32) {
-		kprintf("int_no: %d\n",frame.int_no);
-		kprintf("    errcode: 0x%x\n", frame.errorcode);
-		dump_regs(frame.regs);
+	if (frame->int_no == 14) {
+		int ret = vm_fault(read_cr2(), frame->errorcode);
+		
+		/* Only user mode faults can wait for user space, the faulting
+		 * instruction is restarted once the page is resolved */
+		if (ret == VM_FAULT_BLOCK && (frame->cs & 3)) {
+			task_block();
+			return;
+		} else if (ret == 0) {
+			return;
+		}
+	}
+	
+	if (frame->int_no == 7) {
+		fpu_trap();
+	} else if (frame->int_no < 32) {
+		kprintf("int_no: %d\n",frame->int_no);
+		kprintf("    errcode: 0x%x\n", frame->errorcode);
+		dump_regs(frame->regs);
 		while(1);
-	} else if (frame.int_no == 100) {		
-		syscall_handler(ds, frame);
+	} else if (frame->int_no == SYSCALL_VECTOR) {
+		syscall_handler(frame);
+	} else if (frame->int_no == LAPIC_TIMER_VECTOR) {
+		lapic_eoi();
+		timer_interrupt();
+	} else if (frame->int_no == LAPIC_RESCHED_VECTOR) {
+		lapic_eoi();
+		sched_resched_ipi();
+	} else if (frame->int_no == LAPIC_SPURIOUS_VECTOR) {
+		/* No EOI for spurious interrupts */
+		return;
 	} else {
-		frame.int_no -= 32;
-		if (frame.int_no >= 8)
+		u32 irq = frame->int_no - 32;
+		if (irq >= 8)
 			outb(SLAVE_IRQ_COMMAND, 0x20);
 		outb(MASTER_IRQ_COMMAND, 0x20);
 
-		if (frame.int_no == 0) {
-			sched(frame);
+		for (struct irq_desc *desc = &irq_descriptors[irq];
+			 desc && desc->handler; desc = desc->next) {
+			desc->handler();
 		}
+	}
+}
 
-		struct irq_desc* desc = &irq_descriptors[frame.int_no];
-		while (desc->next != 0) {
-			desc->handler();
-			desc = desc->next;
+void
+interrupt_handler(interrupt_frame_t *frame)
+{
+	int user = frame->cs & 3;
+	int locked = kernel_locked();
+	
+	if (!locked) {
+		lock_kernel();
+	}
+	
+	/* The time until the interrupt was spent in the mode it came from, and
+	 * the time to handle it in the kernel */
+	if (current_task) {
+		task_account(user);
+	}
+	
+	if (frame->int_no >= 32 && frame->int_no != SYSCALL_VECTOR) {
+		u64 start = rdtsc();
+		
+		if (frame->int_no == LAPIC_TIMER_VECTOR || frame->int_no == 32 + IRQ_TIMER) {
+			profile_sample(frame);
 		}
+		
+		this_cpu()->irq_vector = frame->int_no;
+		handle_interrupt(frame);
+		this_cpu()->irq_vector = 0;
+		
+		irq_account(frame->int_no, rdtsc() - start);
+	} else {
+		handle_interrupt(frame);
+	}
+	
+	/* Bottom halves run with interrupts enabled, so not over code that
+	 * disabled them */
+	if (frame->eflags & EFLAGS_IF) {
+		do_softirq();
+	}
+	
+	/* Preempt the task on the way out, unless it was in kernel code that
+	 * can't be */
+	if (current_task && need_resched() &&
+		(user || ((frame->eflags & EFLAGS_IF) && !current_task->preempt_count))) {
+		schedule();
+	}
+	
+	if (current_task && user) {
+		task_account(0);
+	}
+	
+	/* This may be another task than the one that took the lock, the lock
+	 * belongs to the CPU */
+	if (!locked) {
+		unlock_kernel();
 	}
 }
 
@@ -228,11 +596,38 @@ enable_irq(u32 irq)
 {
     if (irq < 8) {
         u8 mask = inb (MASTER_IRQ_DATA);
-        outb (MASTER_IRQ_DATA, mask - (1 << irq));
+        outb (MASTER_IRQ_DATA, mask & ~(1 << irq));
     } else {
         u8 mask = inb (SLAVE_IRQ_DATA);
-        outb (SLAVE_IRQ_DATA, mask - (1 << irq));
+        outb (SLAVE_IRQ_DATA, mask & ~(1 << (irq - 8)));
+        enable_irq(2);
     }
 }
 
+void
+register_irq(u32 irq, irq_handler_t handler)
+{
+    if (irq >= 16)
+        return;
+
+    struct irq_desc *desc = &irq_descriptors[irq];
+
+    if (desc->handler) {
+        while (desc->next)
+            desc = desc->next;
+
+        desc->next = (struct irq_desc *) kmalloc(sizeof(struct irq_desc));
+        if (!desc->next) {
+            kprintf("[ERROR] register_irq: out of memory\n");
+            return;
+        }
+
+        desc = desc->next;
+    }
+
+    desc->next = 0;
+    desc->handler = handler;
+    enable_irq(irq);
+}
+
 
@@ -2,6 +2,7 @@
 #define IDT_H
 
 #include <types.h>
+#include <alien/irq.h>
 
 #define IDT_SIZE 256
 
@@ -11,11 +12,12 @@
 #define IDT_EF_P    0x80
 #define IDT_EF_U    0x60
 
-typedef void (*irq_handler_t) (void);
-
 void idt_install();
-void enable_irq(u32 irq);
-void register_irq(u32 irq, irq_handler_t handler);
+
+/**
+ * Load the IDT built by idt_install() on an application processor.
+ */
+void idt_load();
 void idt_set_gate(u32 num, u32 offset, u8 selector, u8 flags);
 
 #endif
@@ -9,8 +9,10 @@
 
 SECTION .text
 
-GLOBAL idt_flush
-EXTERN interrupt_handler
+CPU_SEL         equ 0x30        ; Per-CPU data segment, see smp.h
+
+GLOBAL idt_flush, isr_return, fork_return
+EXTERN interrupt_handler, unlock_kernel
 
 idt_flush:
 	push eax
@@ -86,6 +88,10 @@ ISR_NOERRCODE 45
 ISR_NOERRCODE 46
 ISR_NOERRCODE 47
 
+ISR_NOERRCODE 48				; Local APIC timer
+ISR_NOERRCODE 49				; Reschedule IPI
+ISR_NOERRCODE 63				; Local APIC spurious
+
 
 ISR_NOERRCODE 100
 
@@ -107,7 +113,10 @@ ISR_NOERRCODE 100
 ; Modifies      : Nothing
 ; Description   : After specifics macros, all default ISRs JMP to this routine.
 ;                 After the IRET, the CPU is in the same state as before the
-;                 interrupt occured.
+;                 interrupt occured. interrupt_handler gets a pointer to the
+;                 frame, and may switch to another task's kernel stack before
+;                 returning. New tasks start at isr_return, over a frame built
+;                 on their own kernel stack.
 
 isr_common:
     pusha
@@ -119,18 +128,29 @@ isr_common:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, CPU_SEL
     mov gs, ax
     
+    lea eax, [esp + 4]
+    push eax        ; interrupt_frame_t *, above the saved DS
     call interrupt_handler
+    add esp, 4
 
+; GS keeps CPU_SEL, user mode can't use it and iret clears it on the way
+isr_return:
     pop ebx         ; restore DS
     mov ds, bx
     mov es, bx
     mov fs, bx
-    mov gs, bx
 
     popa
 
     add esp, 8		; Skipp error code and ISR number
     sti
     iret
+
+; First return of a forked task to user mode, from switch_context() on the
+; kernel stack built by fork()
+fork_return:
+    call unlock_kernel
+    jmp isr_return
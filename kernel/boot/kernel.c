@@ -5,11 +5,17 @@
 
 #include <alien/memory/paging.h>
 #include <alien/memory/kmalloc.h>
+#include <alien/memory/vmalloc.h>
+#include <alien/memory/alloc_profile.h>
 #include <alien/boot/multiboot.h>
-#include <alien/mm.h>
 #include <alien/vfs.h>
 #include <alien/initrd.h>
 #include <alien/ata.h>
+#include <alien/ksyms.h>
+#include <alien/serial.h>
+#include <alien/timer.h>
+#include <alien/fpu.h>
+#include <alien/smp.h>
 
 #include <assert.h>
 
@@ -21,7 +27,9 @@ void
 panic(const char *msg)
 {
     kprintf("[PANIC] %s\n", msg);
-    while(1);
+    while(1) {
+        asm volatile ("cli; hlt");
+    }
 }
 
 int
@@ -81,6 +89,28 @@ user_test()
 	while(1);
 }
 
+#ifdef SMP_SELFTEST
+#define SMP_TEST_THREADS	(2 * MAX_CPUS)
+#define SMP_TEST_SLEEPS		32
+
+/*
+ * Sleep and wake up a few times. The threads are all created on the boot
+ * CPU, so they only reach the others through sched_balance().
+ */
+static void
+smp_test_thread(void *arg)
+{
+	u32 cpus_seen = 0;
+	
+	for (int i = 0; i < SMP_TEST_SLEEPS; i++) {
+		cpus_seen |= 1 << this_cpu()->id;
+		sleep_ticks(1);
+	}
+	
+	kprintf("[SMP] kthread %d ran on CPUs 0x%x\n", (u32) arg, cpus_seen);
+}
+#endif
+
 void
 kernel_main(struct mb_info* mb_info)
 {
@@ -113,8 +143,22 @@ kernel_main(struct mb_info* mb_info)
 		kinfo.len = mod_list->mod_end;
 	}
 	
+	ksyms_init(mb_info);
+	serial_init();
+	
     init_paging();
 	kmalloc_init();
+#ifdef KMALLOC_SELFTEST
+	if (kmalloc_selftest() < 0) {
+		panic("kmalloc self-test failed");
+	}
+#endif
+	vmalloc_init();
+	time_init();
+	fpu_init();
+	
+	lock_kernel();
+	smp_init();
 	
 	//vfs_node_t root;
 	
@@ -147,7 +191,27 @@ kernel_main(struct mb_info* mb_info)
     
     pci_init();
     
+#ifdef ALLOC_PROFILE
+	alloc_profile_dump();
+#endif
+    
+	/* No user space yet, the boot code goes on as a kernel task */
+	tasking_init(kernel_pagedir_frame(), 0, 0, 0, 0);
+	
+#ifdef SMP_SELFTEST
+	for (u32 i = 0; i < SMP_TEST_THREADS; i++) {
+		if (!kthread_create(smp_test_thread, (void *) i)) {
+			kprintf("[ERROR] Can't create kthread %d\n", i);
+		}
+	}
+#endif
+	
     kputs("Boot !");
     
-    while(1);
+	/* Leave the CPU to the kernel threads and the idle task */
+	asm volatile ("cli");
+	
+    while(1) {
+        task_block();
+    }
 }
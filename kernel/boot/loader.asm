@@ -58,7 +58,8 @@ loader:
     mov cr4, ecx
 
     mov ecx, cr0
-    or ecx, 0x80000000              ; Set PG bit in CR0 to enable paging.
+    or ecx, 0x80010000              ; Set PG bit in CR0 to enable paging, and WP
+                                    ; so that the kernel can't write read-only pages.
     mov cr0, ecx
 
     ; Start fetching instructions in kernel space.
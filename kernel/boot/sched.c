@@ -0,0 +1,638 @@
+#include <alien/sched.h>
+#include <alien/task.h>
+#include <alien/smp.h>
+#include <alien/timer.h>
+#include <alien/string.h>
+#include <alien/preempt.h>
+
+struct prio_array {
+	u32            bitmap;		/* Non-empty levels */
+	u32            count;
+	task_header_t *head[SCHED_PRIO_LEVELS];
+	task_header_t *tail[SCHED_PRIO_LEVELS];
+};
+
+struct runqueue {
+	struct prio_array arrays[2];
+	u8                active;			/* Index of the active array */
+	u32               ticks;
+	u32               expired_since;	/* Tick of the first expiration */
+	task_header_t    *dl_head;			/* Deadline tasks, earliest first */
+	u32               dl_bw;			/* Reserved by the deadline tasks */
+};
+
+static struct runqueue runqueues[MAX_CPUS];
+
+static inline struct runqueue *
+this_rq()
+{
+	return &runqueues[this_cpu()->id];
+}
+
+static inline struct prio_array *
+active(struct runqueue *rq)
+{
+	return &rq->arrays[rq->active];
+}
+
+static inline struct prio_array *
+expired(struct runqueue *rq)
+{
+	return &rq->arrays[!rq->active];
+}
+
+static inline u32
+rq_count(struct runqueue *rq)
+{
+	return rq->arrays[0].count + rq->arrays[1].count;
+}
+
+static void
+array_add(struct prio_array *array, task_header_t *task)
+{
+	u8 prio = task->prio;
+	
+	task->rq_next = 0;
+	task->rq_prev = array->tail[prio];
+	
+	if (array->tail[prio])
+		array->tail[prio]->rq_next = task;
+	else
+		array->head[prio] = task;
+	
+	array->tail[prio] = task;
+	array->bitmap |= 1 << prio;
+	array->count++;
+	task->array = array;
+}
+
+static void
+array_remove(task_header_t *task)
+{
+	struct prio_array *array = task->array;
+	u8 prio = task->prio;
+	
+	if (task->rq_prev)
+		task->rq_prev->rq_next = task->rq_next;
+	else
+		array->head[prio] = task->rq_next;
+	
+	if (task->rq_next)
+		task->rq_next->rq_prev = task->rq_prev;
+	else
+		array->tail[prio] = task->rq_prev;
+	
+	if (!array->head[prio])
+		array->bitmap &= ~(1 << prio);
+	
+	array->count--;
+	task->array = 0;
+}
+
+static inline u32
+highest_prio(u32 bitmap)
+{
+	return __builtin_ctz(bitmap);
+}
+
+static u8
+effective_prio(const task_header_t *task)
+{
+	int prio = task->static_prio - task->bonus + SCHED_BONUS_MAX / 2;
+	
+	if (prio < 0)
+		return 0;
+	if (prio >= SCHED_PRIO_LEVELS)
+		return SCHED_PRIO_LEVELS - 1;
+	
+	return prio;
+}
+
+static u8
+timeslice(const task_header_t *task)
+{
+	return SCHED_SLICE_MIN + (SCHED_PRIO_LEVELS - 1 - task->static_prio) / 4;
+}
+
+static inline int
+expired_starving(struct runqueue *rq)
+{
+	return expired(rq)->count &&
+		rq->ticks - rq->expired_since > SCHED_STARVATION_LIMIT;
+}
+
+static void
+rq_enqueue(struct runqueue *rq, task_header_t *task)
+{
+	/* Once the expired tasks have waited too long, nobody goes ahead */
+	array_add(expired_starving(rq) ? expired(rq) : active(rq), task);
+}
+
+/* Wake an idle CPU up: the CPU of @task, or one that can steal it */
+static void
+kick_idle_cpu(task_header_t *task)
+{
+	struct cpu *cpu = &cpus[task->cpu];
+	
+	if (cpu_count == 1) {
+		return;
+	}
+	
+	if (cpu->idle && cpu->task == cpu->idle) {
+		if (cpu != this_cpu()) {
+			smp_send_resched(cpu);
+		}
+		return;
+	}
+	
+	for (u32 i = 0; i < cpu_count; i++) {
+		cpu = &cpus[i];
+		
+		if (cpu != this_cpu() && cpu->idle && cpu->task == cpu->idle) {
+			smp_send_resched(cpu);
+			return;
+		}
+	}
+}
+
+/* Insert @task in the deadline queue of @rq, by absolute deadline */
+static void
+dl_enqueue(struct runqueue *rq, task_header_t *task)
+{
+	task_header_t *prev = 0;
+	task_header_t *next = rq->dl_head;
+	
+	while (next && next->dl.abs_deadline <= task->dl.abs_deadline) {
+		prev = next;
+		next = next->rq_next;
+	}
+	
+	task->rq_prev = prev;
+	task->rq_next = next;
+	
+	if (prev)
+		prev->rq_next = task;
+	else
+		rq->dl_head = task;
+	
+	if (next)
+		next->rq_prev = task;
+	
+	task->dl.queued = 1;
+}
+
+static void
+dl_dequeue(struct runqueue *rq, task_header_t *task)
+{
+	if (task->rq_prev)
+		task->rq_prev->rq_next = task->rq_next;
+	else
+		rq->dl_head = task->rq_next;
+	
+	if (task->rq_next)
+		task->rq_next->rq_prev = task->rq_prev;
+	
+	task->dl.queued = 0;
+}
+
+static void
+dl_new_period(task_header_t *task, u64 start)
+{
+	task->dl.abs_deadline = start + task->dl.deadline;
+	task->dl.budget = task->dl.runtime;
+	task->dl.missed = 0;
+}
+
+/* Charge the CPU time since the last charge to the running @task */
+static void
+dl_charge(task_header_t *task)
+{
+	u64 now = rdtsc();
+	u64 used = now - task->dl.stamp;
+	
+	task->dl.stamp = now;
+	task->dl.budget = used < task->dl.budget ? task->dl.budget - used : 0;
+	
+	if (!task->dl.missed && now > task->dl.abs_deadline) {
+		task->dl.missed = 1;
+		task->dl.misses++;
+	}
+}
+
+/* The runtime of the running @task is used up: keep it off the queues until
+ * its next period */
+static void
+dl_throttle(task_header_t *task)
+{
+	u64 next_period = task->dl.abs_deadline - task->dl.deadline + task->dl.period;
+	u64 now = rdtsc();
+	u32 delay = next_period > now ? tsc_to_jiffies(next_period - now) : 0;
+	
+	task->dl.throttled = 1;
+	task->dl.throttles++;
+	timer_add(&task->dl.timer, jiffies + delay);
+}
+
+/* Return 1 if @task should run instead of the running @curr */
+static inline int
+dl_preempts(const task_header_t *task, const task_header_t *curr)
+{
+	return task && (!curr->dl.bw ||
+		task->dl.abs_deadline < curr->dl.abs_deadline);
+}
+
+/* Make this CPU reschedule if @task, queued on it, should run before the
+ * current task */
+static void
+check_preempt(task_header_t *task)
+{
+	task_header_t *curr = current_task;
+	
+	if (&cpus[task->cpu] != this_cpu() || !curr || curr == task)
+		return;
+	
+	if ((curr->flags & TASK_IDLE) ||
+		(task->dl.bw ? dl_preempts(task, curr)
+					 : !curr->dl.bw && task->prio < curr->prio))
+		set_need_resched();
+}
+
+/* Preempt the CPU of @task if it runs a later deadline or a normal task */
+static void
+dl_kick(task_header_t *task)
+{
+	struct cpu *cpu = &cpus[task->cpu];
+	
+	if (cpu != this_cpu()) {
+		smp_send_resched(cpu);
+	} else {
+		check_preempt(task);
+	}
+}
+
+static void
+dl_replenish(struct timer *timer)
+{
+	task_header_t *task = (task_header_t *) timer->data;
+	u32 flags = irq_save();
+	u64 next_period = task->dl.abs_deadline - task->dl.deadline + task->dl.period;
+	u64 now = rdtsc();
+	
+	/* Periods keep their phase unless the timer was late */
+	dl_new_period(task, next_period > now ? next_period : now);
+	task->dl.throttled = 0;
+	
+	if (task->state == TASK_RUNNING) {
+		dl_enqueue(&runqueues[task->cpu], task);
+		dl_kick(task);
+	}
+	
+	irq_restore(flags);
+}
+
+void
+sched_task_init(task_header_t *task, u8 static_prio)
+{
+	task->static_prio = static_prio;
+	task->bonus = SCHED_BONUS_MAX / 2;
+	task->prio = effective_prio(task);
+	task->timeslice = timeslice(task);
+	task->array = 0;
+}
+
+void
+sched_fork(task_header_t *parent, task_header_t *child)
+{
+	child->static_prio = parent->static_prio;
+	child->bonus = parent->bonus;
+	child->prio = parent->prio;
+	child->timeslice = (parent->timeslice + 1) / 2;
+	parent->timeslice /= 2;
+	child->array = 0;
+	child->cpu = parent->cpu;
+	
+	/* The reservation of a deadline task isn't inherited */
+	memset(&child->dl, 0, sizeof(struct sched_dl));
+	
+	trace_sched_fork(parent, child);
+	
+	sched_enqueue(child);
+}
+
+void
+sched_enqueue(task_header_t *task)
+{
+	if (task->dl.bw) {
+		if (task->dl.throttled) {
+			return;
+		}
+		
+		/* A task waking up keeps its deadline only if the rest of its
+		 * runtime fits in its bandwidth until then */
+		u64 now = rdtsc();
+		
+		if (now >= task->dl.abs_deadline ||
+			task->dl.budget > ((task->dl.abs_deadline - now) * task->dl.bw
+							   >> SCHED_DL_BW_SHIFT)) {
+			dl_new_period(task, now);
+		}
+		
+		dl_enqueue(&runqueues[task->cpu], task);
+		dl_kick(task);
+		return;
+	}
+	
+	rq_enqueue(&runqueues[task->cpu], task);
+	kick_idle_cpu(task);
+	check_preempt(task);
+}
+
+void
+sched_requeue(task_header_t *task)
+{
+	struct runqueue *rq = &runqueues[task->cpu];
+	
+	if (task->dl.bw) {
+		dl_charge(task);
+		
+		if (!task->dl.budget && !task->dl.throttled) {
+			dl_throttle(task);
+		}
+		
+		if (!task->dl.throttled) {
+			dl_enqueue(rq, task);
+			dl_kick(task);
+		}
+		return;
+	}
+	
+	if (task->timeslice > 0) {
+		rq_enqueue(rq, task);
+		return;
+	}
+	
+	if (task->bonus > 0)
+		task->bonus--;
+	
+	task->prio = effective_prio(task);
+	task->timeslice = timeslice(task);
+	
+	if (!expired(rq)->count)
+		rq->expired_since = rq->ticks;
+	
+	array_add(expired(rq), task);
+}
+
+void
+sched_block(task_header_t *task)
+{
+	if (task->dl.bw) {
+		dl_charge(task);
+		return;
+	}
+	
+	if (task->bonus < SCHED_BONUS_MAX)
+		task->bonus++;
+	
+	task->prio = effective_prio(task);
+}
+
+int
+sched_balance()
+{
+	struct runqueue *rq = this_rq();
+	struct runqueue *busiest = 0;
+	
+	for (u32 i = 0; i < cpu_count; i++) {
+		struct runqueue *other = &runqueues[i];
+		
+		if (other != rq && rq_count(other) &&
+			(!busiest || rq_count(other) > rq_count(busiest))) {
+			busiest = other;
+		}
+	}
+	
+	if (!busiest) {
+		return 0;
+	}
+	
+	/* Expired tasks would wait the longest on their CPU */
+	struct prio_array *array = expired(busiest)->count ? expired(busiest)
+													   : active(busiest);
+	task_header_t *task = array->head[highest_prio(array->bitmap)];
+	
+	array_remove(task);
+	task->cpu = this_cpu()->id;
+	array_add(active(rq), task);
+	
+	return 1;
+}
+
+task_header_t *
+sched_pick_next()
+{
+	struct runqueue *rq = this_rq();
+	
+	if (rq->dl_head) {
+		task_header_t *task = rq->dl_head;
+		
+		dl_dequeue(rq, task);
+		task->dl.stamp = rdtsc();
+		
+		return task;
+	}
+	
+	if (!rq_count(rq)) {
+		sched_balance();
+	}
+	
+	if (!active(rq)->bitmap) {
+		rq->active = !rq->active;
+		rq->expired_since = rq->ticks;
+	}
+	
+	struct prio_array *array = active(rq);
+	
+	if (!array->bitmap)
+		return (task_header_t *) 0;
+	
+	task_header_t *task = array->head[highest_prio(array->bitmap)];
+	array_remove(task);
+	
+	return task;
+}
+
+int
+sched_runnable()
+{
+	struct runqueue *rq = this_rq();
+	
+	return rq_count(rq) != 0 || rq->dl_head;
+}
+
+int
+sched_tick(task_header_t *task, u32 elapsed)
+{
+	struct runqueue *rq = this_rq();
+	struct prio_array *array = active(rq);
+	
+	rq->ticks += elapsed;
+	
+	if (task->flags & TASK_IDLE)
+		return sched_runnable();
+	
+	/* The task is blocked, or was woken while the CPU idled in schedule()
+	 * and is queued already */
+	if (task->state != TASK_RUNNING || task->array || task->dl.queued)
+		return 0;
+	
+	if (task->dl.bw) {
+		dl_charge(task);
+		
+		if (!task->dl.budget) {
+			dl_throttle(task);
+			return 1;
+		}
+		
+		return dl_preempts(rq->dl_head, task);
+	}
+	
+	if (dl_preempts(rq->dl_head, task))
+		return 1;
+	
+	task->timeslice = task->timeslice > elapsed ? task->timeslice - elapsed : 0;
+	
+	if (task->timeslice == 0) {
+		/* Let an idle CPU take some of the waiting tasks */
+		if (rq_count(rq)) {
+			kick_idle_cpu(task);
+		}
+		return 1;
+	}
+	
+	return array->bitmap && highest_prio(array->bitmap) < task->prio;
+}
+
+void
+sched_resched_ipi()
+{
+	task_header_t *task = current_task;
+	
+	/* An AP waiting for its idle task */
+	if (!task) {
+		return;
+	}
+	
+	if (sched_tick(task, 0)) {
+		set_need_resched();
+	}
+	
+	clock_program();
+}
+
+int
+sched_set_priority(task_header_t *task, u32 prio)
+{
+	if (prio >= SCHED_PRIO_LEVELS)
+		return -1;
+	
+	struct prio_array *array = task->array;
+	
+	if (array)
+		array_remove(task);
+	
+	task->static_prio = prio;
+	task->prio = effective_prio(task);
+	
+	if (array)
+		array_add(array, task);
+	
+	return 0;
+}
+
+/* Take the bandwidth of @task back from its CPU */
+static void
+dl_release(task_header_t *task)
+{
+	if (!task->dl.bw) {
+		return;
+	}
+	
+	runqueues[task->cpu].dl_bw -= task->dl.bw;
+	timer_cancel(&task->dl.timer);
+	
+	if (task->dl.queued) {
+		dl_dequeue(&runqueues[task->cpu], task);
+	}
+	
+	task->dl.bw = 0;
+	task->dl.throttled = 0;
+}
+
+int
+sched_set_deadline(const struct sched_dl_attr *attr)
+{
+	task_header_t *task = current_task;
+	
+	if (attr->runtime == 0) {
+		dl_release(task);
+		schedule();
+		return 0;
+	}
+	
+	if (attr->runtime > attr->deadline || attr->deadline > attr->period ||
+		attr->period > SCHED_DL_PERIOD_MAX) {
+		return -1;
+	}
+	
+	u32 bw = udiv64((u64) attr->runtime << SCHED_DL_BW_SHIFT, attr->deadline);
+	u32 old_bw = task->dl.bw;
+	struct runqueue *best = 0;
+	u32 best_reserved = 0;
+	
+	/* Admission: the CPU with the most bandwidth left, if it fits */
+	for (u32 i = 0; i < cpu_count; i++) {
+		u32 reserved = runqueues[i].dl_bw - (i == task->cpu ? old_bw : 0);
+		
+		if (reserved + bw <= SCHED_DL_BW_LIMIT &&
+			(!best || reserved < best_reserved)) {
+			best = &runqueues[i];
+			best_reserved = reserved;
+		}
+	}
+	
+	if (!best) {
+		return -1;
+	}
+	
+	dl_release(task);
+	
+	task->dl.bw = bw;
+	task->dl.runtime = us_to_tsc(attr->runtime);
+	task->dl.deadline = us_to_tsc(attr->deadline);
+	task->dl.period = us_to_tsc(attr->period);
+	task->dl.stamp = rdtsc();
+	timer_init(&task->dl.timer, dl_replenish, task);
+	dl_new_period(task, task->dl.stamp);
+	
+	task->cpu = best - runqueues;
+	best->dl_bw += bw;
+	
+	/* Queue the task on its CPU, ahead of the normal tasks */
+	schedule();
+	
+	return 0;
+}
+
+void
+sched_dl_stats(task_header_t *task, struct sched_dl_stats *stats)
+{
+	stats->misses = task->dl.misses;
+	stats->throttles = task->dl.throttles;
+}
+
+void
+sched_exit(task_header_t *task)
+{
+	dl_release(task);
+}
@@ -0,0 +1,135 @@
+#include <alien/sched_trace.h>
+#include <alien/task.h>
+#include <alien/timer.h>
+#include <alien/string.h>
+
+static struct sched_event ring[SCHED_TRACE_SIZE];
+static u32 head = 0, tail = 0;
+static u32 lost = 0;
+
+static void
+trace_event(u8 type, u8 state, u32 pid, u32 other, u64 tsc)
+{
+	u32 flags = irq_save();
+	
+	/* Keep the latest events */
+	if (head - tail == SCHED_TRACE_SIZE) {
+		tail++;
+		lost++;
+	}
+	
+	struct sched_event *event = &ring[head++ % SCHED_TRACE_SIZE];
+	
+	event->tsc = tsc;
+	event->type = type;
+	event->cpu = this_cpu()->id;
+	event->state = state;
+	event->reserved = 0;
+	event->pid = pid;
+	event->other = other;
+	
+	irq_restore(flags);
+}
+
+/* Count @cycles in @hist, and return them in microseconds */
+static u32
+hist_add(u32 *hist, u64 cycles)
+{
+	u32 us = (u32) tsc_to_us(cycles);
+	u32 bucket = us ? 31 - __builtin_clz(us) : 0;
+	
+	if (bucket >= SCHED_HIST_BUCKETS) {
+		bucket = SCHED_HIST_BUCKETS - 1;
+	}
+	
+	hist[bucket]++;
+	
+	return us;
+}
+
+void
+trace_sched_switch(task_header_t *prev, task_header_t *next)
+{
+	u64 now = rdtsc();
+	
+	if (prev->run_stamp) {
+		u32 us = hist_add(prev->hist.run_slice, now - prev->run_stamp);
+		
+		if (us > prev->hist.run_slice_max) {
+			prev->hist.run_slice_max = us;
+		}
+	}
+	
+	if (next->wake_stamp) {
+		u32 us = hist_add(next->hist.wakeup_latency, now - next->wake_stamp);
+		
+		if (us > next->hist.wakeup_latency_max) {
+			next->hist.wakeup_latency_max = us;
+		}
+		
+		next->wake_stamp = 0;
+	}
+	
+	next->run_stamp = now;
+	
+	trace_event(SCHED_EV_SWITCH, prev->state, prev->info.pid, next->info.pid, now);
+}
+
+void
+trace_sched_wakeup(task_header_t *task)
+{
+	u64 now = rdtsc();
+	task_header_t *waker = current_task;
+	
+	task->wake_stamp = now;
+	trace_event(SCHED_EV_WAKEUP, task->state, task->info.pid,
+				waker ? waker->info.pid : 0, now);
+}
+
+void
+trace_sched_block(task_header_t *task)
+{
+	trace_event(SCHED_EV_BLOCK, task->state, task->info.pid, 0, rdtsc());
+}
+
+void
+trace_sched_fork(task_header_t *parent, task_header_t *child)
+{
+	u64 now = rdtsc();
+	
+	memset(&child->hist, 0, sizeof(struct sched_hist));
+	child->run_stamp = 0;
+	
+	/* The wait until its first run counts as a wakeup latency */
+	child->wake_stamp = now;
+	
+	trace_event(SCHED_EV_FORK, child->state, parent->info.pid,
+				child->info.pid, now);
+}
+
+u32
+sched_trace_read(struct sched_event *events, u32 count)
+{
+	u32 flags = irq_save();
+	u32 n = 0;
+	
+	if (lost && count) {
+		events[n].tsc = rdtsc();
+		events[n].type = SCHED_EV_LOST;
+		events[n].cpu = this_cpu()->id;
+		events[n].state = 0;
+		events[n].reserved = 0;
+		events[n].pid = 0;
+		events[n].other = lost;
+		n++;
+		lost = 0;
+	}
+	
+	while (n < count && tail != head) {
+		events[n++] = ring[tail++ % SCHED_TRACE_SIZE];
+	}
+	
+	irq_restore(flags);
+	
+	return n;
+}
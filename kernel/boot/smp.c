@@ -0,0 +1,202 @@
+#include <alien/smp.h>
+#include <alien/spinlock.h>
+#include <alien/apic.h>
+#include <alien/acpi.h>
+#include <alien/task.h>
+#include <alien/timer.h>
+#include <alien/fpu.h>
+#include <alien/kernel.h>
+#include <alien/string.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/vmalloc.h>
+#include "gdt.h"
+#include "idt.h"
+
+#define TRAMPOLINE_BASE		0x8000
+#define AP_STACK_SIZE		PAGE_SIZE
+#define AP_START_TIMEOUT_MS	100
+
+/* Defined in smp_trampoline.asm */
+extern u8 trampoline_start[];
+extern u8 trampoline_end[];
+extern u8 trampoline_data[];
+
+struct trampoline_data {
+	u32 cr3;
+	u32 stack;
+} __attribute__((packed));
+
+struct cpu cpus[MAX_CPUS];
+u32 cpu_count = 1;
+
+volatile u32 kernel_tlb_gen = 0;
+
+static spinlock_t kernel_lock = SPINLOCK_INIT;
+static struct cpu *volatile kernel_lock_owner = 0;
+
+/* AP being started, read by ap_main() before it can use this_cpu() */
+static struct cpu *volatile ap_booting = 0;
+
+static inline void
+flush_tlb()
+{
+	asm volatile ("mov %%cr3, %%eax; mov %%eax, %%cr3" ::: "eax", "memory");
+}
+
+void
+lock_kernel()
+{
+	struct cpu *cpu = this_cpu();
+	
+	spin_lock(&kernel_lock);
+	kernel_lock_owner = cpu;
+	
+	/* Other CPUs may have unmapped kernel pages since we last held the
+	 * lock, their entries may still be in our TLB */
+	if (cpu->tlb_gen != kernel_tlb_gen) {
+		cpu->tlb_gen = kernel_tlb_gen;
+		flush_tlb();
+	}
+}
+
+void
+unlock_kernel()
+{
+	kernel_lock_owner = 0;
+	spin_unlock(&kernel_lock);
+}
+
+int
+kernel_locked()
+{
+	return kernel_lock_owner == this_cpu();
+}
+
+void
+cpu_halt()
+{
+	int locked = kernel_locked();
+	
+	if (locked) {
+		unlock_kernel();
+	}
+	
+	/* sti only takes effect after hlt, no interrupt is missed */
+	asm volatile ("sti; hlt; cli");
+	
+	if (locked) {
+		lock_kernel();
+	}
+}
+
+void
+smp_send_resched(struct cpu *cpu)
+{
+	lapic_send_ipi(cpu->apic_id, LAPIC_RESCHED_VECTOR);
+}
+
+/* Entered from the trampoline, on the boot stack of the AP */
+void
+ap_main()
+{
+	struct cpu *cpu = ap_booting;
+	
+	gdt_install_cpu(cpu);
+	idt_load();
+	lapic_enable();
+	fpu_init();
+	
+	cpu->tick_jiffies = jiffies;
+	cpu->online = 1;
+	
+	lock_kernel();
+	kprintf("[SMP] CPU %d online, APIC ID %d\n", cpu->id, cpu->apic_id);
+	
+	/* tasking_init() creates the idle tasks */
+	while (!cpu->idle) {
+		cpu_halt();
+	}
+	
+	task_enter_idle();
+}
+
+static int
+start_ap(struct cpu *cpu)
+{
+	lapic_send_init(cpu->apic_id);
+	pit_delay_ms(10);
+	
+	for (int i = 0; i < 2 && !cpu->online; i++) {
+		lapic_send_startup(cpu->apic_id, TRAMPOLINE_BASE);
+		pit_delay_ms(1);
+	}
+	
+	for (int ms = 0; ms < AP_START_TIMEOUT_MS && !cpu->online; ms++) {
+		pit_delay_ms(1);
+	}
+	
+	return cpu->online ? 0 : -1;
+}
+
+void
+smp_init()
+{
+	u8 apic_ids[MAX_CPUS];
+	u32 count = acpi_madt_cpus(apic_ids, MAX_CPUS);
+	
+	/* APs are only woken with IPIs and ticked by their local APIC */
+	if (count < 2 || !lapic_ticks_per_jiffy) {
+		return;
+	}
+	
+	u8 self = lapic_id();
+	boot_cpu()->apic_id = self;
+	boot_cpu()->online = 1;
+	
+	/* The trampoline runs at its physical address until paging is enabled,
+	 * so it's identity mapped in the kernel page directory meanwhile */
+	u32 size = trampoline_end - trampoline_start;
+	struct trampoline_data *data = (struct trampoline_data *)
+		(kinfo.vbase + TRAMPOLINE_BASE + (trampoline_data - trampoline_start));
+	
+	memcpy((void *) (kinfo.vbase + TRAMPOLINE_BASE), trampoline_start, size);
+	
+	if (!map_at(TRAMPOLINE_BASE, TRAMPOLINE_BASE, PAGE_RW)) {
+		kprintf("[ERROR] smp_init: Can't map the trampoline\n");
+		return;
+	}
+	
+	data->cr3 = kernel_pagedir_frame();
+	
+	for (u32 i = 0; i < count && cpu_count < MAX_CPUS; i++) {
+		struct cpu *cpu = &cpus[cpu_count];
+		
+		if (apic_ids[i] == self) {
+			continue;
+		}
+		
+		cpu->apic_id = apic_ids[i];
+		cpu->kstack = (u32) vmalloc(AP_STACK_SIZE);
+		
+		if (!cpu->kstack) {
+			break;
+		}
+		
+		data->stack = cpu->kstack + AP_STACK_SIZE;
+		ap_booting = cpu;
+		
+		if (start_ap(cpu) < 0) {
+			kprintf("[ERROR] smp_init: CPU with APIC ID %d didn't start\n",
+					cpu->apic_id);
+			vfree((void *) cpu->kstack);
+			memset(cpu, 0, sizeof(struct cpu));
+			continue;
+		}
+		
+		cpu_count++;
+	}
+	
+	unmap(TRAMPOLINE_BASE);
+	
+	kprintf("[SMP] %d CPUs online\n", cpu_count);
+}
@@ -0,0 +1,72 @@
+;-------------------------------------------------------------------------------
+; Source name   : smp_trampoline.asm
+; Description   : Start code of the application processors. smp_init() copies
+;                 it to TRAMPOLINE_BASE, which is identity mapped while the
+;                 processors start, and fills trampoline_data. The STARTUP IPI
+;                 starts a processor in real mode at TRAMPOLINE_BASE.
+;-------------------------------------------------------------------------------
+
+TRAMPOLINE_BASE equ 0x8000
+
+; Address of a trampoline label once copied
+%define REL(label) (TRAMPOLINE_BASE + ((label) - trampoline_start))
+
+SECTION .text
+
+GLOBAL trampoline_start, trampoline_end, trampoline_data
+EXTERN ap_main
+
+[bits 16]
+trampoline_start:
+    cli
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [REL(trampoline_gdt_ptr)]
+
+    mov eax, cr0
+    or eax, 1                       ; Set PE bit
+    mov cr0, eax
+
+    jmp dword 0x08:REL(trampoline_protected)
+
+[bits 32]
+trampoline_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov eax, [REL(trampoline_cr3)]
+    mov cr3, eax
+
+    mov eax, cr0
+    or eax, 0x80010000              ; Set PG and WP bits
+    mov cr0, eax
+
+    mov esp, [REL(trampoline_stack)]
+
+    mov eax, ap_main                ; Absolute jump to kernel space
+    jmp eax
+
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF           ; Flat kernel code, same as K_CODE_SEL
+    dq 0x00CF92000000FFFF           ; Flat kernel data, same as K_DATA_SEL
+
+trampoline_gdt_ptr:
+    dw 3 * 8 - 1
+    dd REL(trampoline_gdt)
+
+; struct trampoline_data in smp.c
+align 4
+trampoline_data:
+trampoline_cr3:
+    dd 0
+trampoline_stack:
+    dd 0
+
+trampoline_end:
@@ -0,0 +1,220 @@
+#include <alien/softirq.h>
+#include <alien/preempt.h>
+#include <alien/smp.h>
+#include <alien/timer.h>
+#include <alien/kernel.h>
+
+#define IRQ_VECTORS		256
+
+static void tasklet_action();
+
+static softirq_fn_t softirq_handlers[SOFTIRQ_COUNT] = {
+	[SOFTIRQ_TASKLET] = tasklet_action,
+};
+
+/* Vector of the interrupt that raised each pending softirq */
+static u8 softirq_vectors[MAX_CPUS][SOFTIRQ_COUNT];
+
+/* Pushed by tasklet_schedule(), taken as a whole by tasklet_action() */
+static struct tasklet *volatile tasklet_lists[MAX_CPUS];
+
+static struct irq_stats irq_stats[IRQ_VECTORS];
+
+/* Count a bottom half queued from the interrupt running on this CPU */
+static u8
+irq_defer()
+{
+	u8 vector = this_cpu()->irq_vector;
+	struct irq_stats *stats = &irq_stats[vector];
+	
+	stats->deferred++;
+	
+	if (stats->deferred - stats->done > stats->max_backlog) {
+		stats->max_backlog = stats->deferred - stats->done;
+	}
+	
+	return vector;
+}
+
+void
+open_softirq(u32 nr, softirq_fn_t fn)
+{
+	softirq_handlers[nr] = fn;
+}
+
+void
+raise_softirq(u32 nr)
+{
+	struct cpu *cpu = this_cpu();
+	
+	if (cpu->softirq_pending & (1 << nr)) {
+		return;
+	}
+	
+	cpu->softirq_pending |= 1 << nr;
+	
+	/* Tasklets are counted one by one */
+	if (nr != SOFTIRQ_TASKLET) {
+		softirq_vectors[cpu->id][nr] = irq_defer();
+	}
+}
+
+void
+do_softirq()
+{
+	struct cpu *cpu = this_cpu();
+	
+	if (cpu->in_softirq || !cpu->softirq_pending) {
+		return;
+	}
+	
+	u32 flags = irq_save();
+	
+	preempt_disable();
+	cpu->in_softirq = 1;
+	
+	for (int restart = 0; cpu->softirq_pending && restart < SOFTIRQ_MAX_RESTART;
+		 restart++) {
+		u32 pending = cpu->softirq_pending;
+		u8 vectors[SOFTIRQ_COUNT];
+		
+		for (u32 nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+			vectors[nr] = softirq_vectors[cpu->id][nr];
+		}
+		
+		cpu->softirq_pending = 0;
+		asm volatile ("sti");
+		
+		while (pending) {
+			u32 nr = __builtin_ctz(pending);
+			
+			pending &= pending - 1;
+			softirq_handlers[nr]();
+			
+			if (nr != SOFTIRQ_TASKLET) {
+				irq_stats[vectors[nr]].done++;
+			}
+		}
+		
+		asm volatile ("cli");
+	}
+	
+	cpu->in_softirq = 0;
+	preempt_enable();
+	irq_restore(flags);
+}
+
+int
+softirq_pending()
+{
+	return this_cpu()->softirq_pending != 0;
+}
+
+void
+tasklet_init(struct tasklet *tasklet, tasklet_fn_t fn, void *data)
+{
+	tasklet->next = 0;
+	tasklet->fn = fn;
+	tasklet->data = data;
+	tasklet->queued = 0;
+	tasklet->vector = 0;
+}
+
+int
+tasklet_schedule(struct tasklet *tasklet)
+{
+	if (__sync_lock_test_and_set(&tasklet->queued, 1)) {
+		return 0;
+	}
+	
+	u32 flags = irq_save();
+	struct tasklet *volatile *list = &tasklet_lists[this_cpu()->id];
+	struct tasklet *head;
+	
+	tasklet->vector = irq_defer();
+	
+	do {
+		head = *list;
+		tasklet->next = head;
+	} while (!__sync_bool_compare_and_swap(list, head, tasklet));
+	
+	raise_softirq(SOFTIRQ_TASKLET);
+	irq_restore(flags);
+	
+	return 1;
+}
+
+static void
+tasklet_action()
+{
+	struct tasklet *list = __sync_lock_test_and_set(&tasklet_lists[this_cpu()->id],
+													(struct tasklet *) 0);
+	struct tasklet *ordered = 0;
+	
+	/* The list was pushed to, run the tasklets in the order they came */
+	while (list) {
+		struct tasklet *next = list->next;
+		
+		list->next = ordered;
+		ordered = list;
+		list = next;
+	}
+	
+	while (ordered) {
+		struct tasklet *tasklet = ordered;
+		u8 vector = tasklet->vector;
+		
+		ordered = tasklet->next;
+		__sync_lock_release(&tasklet->queued);
+		
+		tasklet->fn(tasklet);
+		irq_stats[vector].done++;
+	}
+}
+
+void
+irq_account(u32 vector, u32 cycles)
+{
+	struct irq_stats *stats = &irq_stats[vector];
+	
+	stats->count++;
+	stats->cycles += cycles;
+	
+	if (cycles > stats->max_cycles) {
+		stats->max_cycles = cycles;
+	}
+}
+
+int
+irq_get_stats(u32 vector, struct irq_stats *stats)
+{
+	if (vector >= IRQ_VECTORS) {
+		return -1;
+	}
+	
+	u32 flags = irq_save();
+	*stats = irq_stats[vector];
+	irq_restore(flags);
+	
+	return 0;
+}
+
+void
+irq_stats_dump()
+{
+	kprintf("vector      count   top_us  max_us  deferred  backlog  max_backlog\n");
+	
+	for (u32 v = 0; v < IRQ_VECTORS; v++) {
+		struct irq_stats s;
+		
+		irq_get_stats(v, &s);
+		
+		if (!s.count && !s.deferred) {
+			continue;
+		}
+		
+		kprintf("%6d %10u %8u %7u %9u %8u %12u\n", v, s.count,
+				(u32) tsc_to_us(s.cycles), (u32) tsc_to_us(s.max_cycles),
+				s.deferred, s.deferred - s.done, s.max_backlog);
+	}
+}
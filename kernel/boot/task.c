@@ -1,46 +1,102 @@
 #include <alien/task.h>
+#include <alien/sched.h>
 #include <assert.h>
 #include <alien/string.h>
 #include <alien/memory/paging.h>
-#include <alien/memory/kmalloc.h>
+#include <alien/memory/slab.h>
+#include <alien/memory/vm.h>
+#include <alien/memory/uffd.h>
+#include <alien/memory/vmalloc.h>
+#include <alien/workqueue.h>
+#include <alien/timer.h>
+#include <alien/fpu.h>
+#include <alien/preempt.h>
+#include <alien/softirq.h>
 #include "gdt.h"
 
 extern void user_space_switch(u32 eip, u32 esp, u32 ss, u32 cs);
 
-extern void execute_task(task_info_t info);
-extern u32 kernel_stack;
-extern void tss_flush(u32 index);
+extern void switch_context(u32 *prev_esp, u32 next_esp);
+extern void fork_return();
 
-struct tss_entry kernel_tss;
 task_header_t task_list;
-task_header_t *current_task;
+
+static struct kmem_cache *task_cache;
+
+static task_header_t *kthread_alloc(kthread_fn_t fn, void *arg);
+static void idle_thread(void *arg);
+
+/*
+ * Initial kernel stack of a forked task: switch_context() returns to
+ * fork_return, which drops the kernel lock and goes back to user mode with
+ * the copied frame.
+ */
+struct fork_stack {
+	u32               edi, esi, ebx, ebp;
+	u32               ret;
+	u32               ds;
+	interrupt_frame_t frame;
+} __attribute__((packed));
+
+/* Initial kernel stack of a kernel thread, switch_context() returns to
+ * kthread_start(fn, arg) */
+struct kthread_stack {
+	u32          edi, esi, ebx, ebp;
+	u32          ret;
+	u32          start_ret;		/* Never used, kthread_start() doesn't return */
+	kthread_fn_t fn;
+	void        *arg;
+} __attribute__((packed));
 
 void
 tasking_init(u32 cr3, u32 eip, u32 esp, u32 ss, u32 cs)
 {
-    memset(&kernel_tss, 0, sizeof(struct tss_entry));
-    kernel_tss.ss0 = 0x10;
-    kernel_tss.cs = 0x08;
+    task_list.kstack = (u32) vmalloc(KERNEL_STACK_SIZE);
+    assert(task_list.kstack);
+    
+    tss_set_esp0(task_list.kstack + KERNEL_STACK_SIZE);
 
-    kernel_tss.esp0 = (u32) &kernel_stack;
-    gdt_set_gate(5, (u32) &kernel_tss, sizeof(struct tss_entry) - 1, 0xE9, 0xCF);
-    tss_flush(5 * 8 | 3);
+    task_cache = kmem_cache_create("task", sizeof(task_header_t),
+                                   SLAB_HWCACHE_ALIGN, 0);
 
     current_task = &task_list;
     current_task->next = current_task;
     
-    memset(&current_task->info.regs, 0, sizeof(struct regs));    
     current_task->info.esp = esp;
     current_task->info.ss = ss;
     current_task->info.cs = cs;
     current_task->info.eip = eip;
     current_task->info.cr3 = cr3;
     current_task->info.pid = 0;
+    current_task->vm_areas = 0;
+    current_task->state = TASK_RUNNING;
+    current_task->flags = 0;
+    current_task->cpu = this_cpu()->id;
+    arena_init(&current_task->scratch);
+    sched_task_init(current_task, SCHED_PRIO_DEFAULT);
+    
+    /* The APs wait for their idle task in ap_main() */
+    for (u32 i = 0; i < cpu_count; i++) {
+        task_header_t *idle = kthread_alloc(idle_thread, 0);
+        assert(idle);
+        
+        idle->flags |= TASK_IDLE;
+        idle->cpu = i;
+        cpus[i].acct_stamp = rdtsc();
+        cpus[i].idle = idle;
+        
+        if (&cpus[i] != this_cpu()) {
+            smp_send_resched(&cpus[i]);
+        }
+    }
+    
+    workqueue_init();
 }
 
 void
 usermode()
 {
+	unlock_kernel();
 	switch_page_dir(current_task->info.cr3);
 	user_space_switch(current_task->info.eip,
 						current_task->info.esp,
@@ -48,56 +104,370 @@ usermode()
 						current_task->info.cs);
 }
 
+static void
+reap_dead_task()
+{
+	task_header_t *task = this_cpu()->dead_task;
+	
+	if (!task || task == current_task) {
+		return;
+	}
+	
+	this_cpu()->dead_task = 0;
+	
+	if (!(task->flags & TASK_KTHREAD)) {
+		free_user_pagedir(task->info.cr3);
+	}
+	
+	vfree((void *) task->kstack);
+	
+	if (task != &task_list) {
+		kmem_cache_free(task_cache, task);
+	}
+}
+
 void
-tasking_set_esp0(u32 esp0)
+schedule()
 {
-    kernel_tss.esp0 = esp0;
+	task_header_t *prev = current_task;
+	
+	if (prev->preempt_count) {
+		kprintf("[ERROR] schedule: task %d has preemption disabled\n",
+				prev->info.pid);
+	}
+	
+	this_cpu()->need_resched = 0;
+	
+	if (prev->state == TASK_RUNNING && !(prev->flags & TASK_IDLE)) {
+		sched_requeue(prev);
+	}
+	
+	task_header_t *next = sched_pick_next();
+	
+	if (!next) {
+		next = this_cpu()->idle;
+	}
+	
+	task_account(0);
+	
+	if (next == prev) {
+		clock_program();
+		return;
+	}
+	
+	trace_sched_switch(prev, next);
+	
+	current_task = next;
+	clock_program();
+	fpu_switch(prev, next);
+	tss_set_esp0(next->kstack + KERNEL_STACK_SIZE);
+	if (next->info.cr3 != prev->info.cr3) {
+		switch_page_dir(next->info.cr3);
+	}
+	
+	switch_context(&prev->kesp, next->kesp);
+	
+	reap_dead_task();
 }
 
-static inline void
-save_current_task(interrupt_frame_t frame)
+i32
+fork(const interrupt_frame_t *frame)
+{	
+	task_header_t *new_header = (task_header_t *) kmem_cache_alloc(task_cache);
+	if (!new_header) {
+		return -1;
+	}
+	
+	u32 kstack = (u32) vmalloc(KERNEL_STACK_SIZE);
+	if (!kstack) {
+		kmem_cache_free(task_cache, new_header);
+		return -1;
+	}
+	
+	memcpy(new_header, current_task, sizeof(task_header_t));
+	new_header->info.pid++;
+	new_header->parent = current_task;
+	new_header->utime = 0;
+	new_header->stime = 0;
+	new_header->preempt_count = 0;
+	
+	if (fpu_fork(current_task, new_header) < 0) {
+		vfree((void *) kstack);
+		kmem_cache_free(task_cache, new_header);
+		return -1;
+	}
+		
+	new_header->info.cr3 = copy_current_pagedir();
+	new_header->vm_areas = vm_copy_areas(current_task->vm_areas);
+	arena_init(&new_header->scratch);
+	
+	struct fork_stack *stack = (struct fork_stack *)
+		(kstack + KERNEL_STACK_SIZE - sizeof(struct fork_stack));
+	
+	memset(stack, 0, sizeof(struct fork_stack));
+	stack->ret = (u32) fork_return;
+	stack->ds = frame->ss;
+	stack->frame = *frame;
+	stack->frame.regs.eax = 0;
+	
+	new_header->kstack = kstack;
+	new_header->kesp = (u32) stack;
+	
+	new_header->next = current_task->next;
+	current_task->next = new_header;
+	sched_fork(current_task, new_header);
+	
+	return 1;
+}
+
+static void
+kthread_start(kthread_fn_t fn, void *arg)
 {
-	current_task->info.regs = frame.regs;
-    current_task->info.esp = frame.esp;
-    current_task->info.ss = frame.ss;
-    current_task->info.cs = frame.cs;
-    current_task->info.eip = frame.eip,
-    current_task->info.eflags = frame.eflags;
+	/* Switches happen with interrupts disabled */
+	asm volatile ("sti");
+	
+	fn(arg);
+	
+	asm volatile ("cli");
+	task_exit();
+}
+
+static task_header_t *
+kthread_alloc(kthread_fn_t fn, void *arg)
+{
+	task_header_t *task = (task_header_t *) kmem_cache_alloc(task_cache);
+	if (!task) {
+		return 0;
+	}
+	
+	u32 kstack = (u32) vmalloc(KERNEL_STACK_SIZE);
+	if (!kstack) {
+		kmem_cache_free(task_cache, task);
+		return 0;
+	}
+	
+	memset(task, 0, sizeof(task_header_t));
+	task->info.pid = current_task->info.pid + 1;
+	task->info.cr3 = kernel_pagedir_frame();
+	task->parent = current_task;
+	task->flags = TASK_KTHREAD;
+	task->state = TASK_RUNNING;
+	task->cpu = this_cpu()->id;
+	arena_init(&task->scratch);
+	sched_task_init(task, SCHED_PRIO_DEFAULT);
+	
+	struct kthread_stack *stack = (struct kthread_stack *)
+		(kstack + KERNEL_STACK_SIZE - sizeof(struct kthread_stack));
+	
+	memset(stack, 0, sizeof(struct kthread_stack));
+	stack->ret = (u32) kthread_start;
+	stack->fn = fn;
+	stack->arg = arg;
+	
+	task->kstack = kstack;
+	task->kesp = (u32) stack;
+	
+	return task;
 }
 
+task_header_t *
+kthread_create(kthread_fn_t fn, void *arg)
+{
+	task_header_t *task = kthread_alloc(fn, arg);
+	if (!task) {
+		return 0;
+	}
+	
+	u32 flags = irq_save();
+	task->next = current_task->next;
+	current_task->next = task;
+	sched_enqueue(task);
+	irq_restore(flags);
+	
+	return task;
+}
+
+/*
+ * Halt until an interrupt makes a task runnable. The time spent here is the
+ * system time of the idle task.
+ */
 static void
-do_sched()
+idle_thread(void *arg)
 {
-	current_task = current_task->next;
+	(void) arg;
+	
+	while (1) {
+		asm volatile ("cli");
+		
+		/* Left over by an interrupt with too much to do */
+		do_softirq();
+		
+		if (sched_runnable() || sched_balance()) {
+			schedule();
+		} else {
+			cpu_halt();
+		}
+	}
+}
 
-    execute_task(current_task->info);
+void
+preempt_schedule()
+{
+	u32 flags = irq_save();
+	
+	/* Interrupts could have preempted the task anyway */
+	if ((flags & EFLAGS_IF) && need_resched() && !current_task->preempt_count) {
+		schedule();
+	}
+	
+	irq_restore(flags);
 }
 
 void
-sched(interrupt_frame_t frame)
+cond_resched()
 {
-    save_current_task(frame);
-    do_sched();
+	task_header_t *task = current_task;
+	
+	if (!task || task->preempt_count) {
+		return;
+	}
+	
+	u32 flags = irq_save();
+	
+	/* An interrupt pending here preempts the task on its way out */
+	asm volatile ("sti; nop; cli");
+	
+	if (need_resched()) {
+		schedule();
+	}
+	
+	irq_restore(flags);
 }
 
 void
-fork(interrupt_frame_t frame)
-{	
-	task_header_t *new_header = (task_header_t *) kmalloc(sizeof(task_header_t));
-	assert(new_header);
+task_enter_idle()
+{
+	struct cpu *cpu = this_cpu();
+	u32 unused;
 	
-	save_current_task(frame);
+	cpu->task = cpu->idle;
+	cpu->acct_stamp = rdtsc();
+	tss_set_esp0(cpu->idle->kstack + KERNEL_STACK_SIZE);
+	clock_program();
 	
-	memcpy(new_header, current_task, sizeof(task_header_t));
-	new_header->info.pid++;
+	switch_context(&unused, cpu->idle->kesp);
+	panic("Idle task returned");
+}
+
+void
+task_account(int user)
+{
+	struct cpu *cpu = this_cpu();
+	u64 now = rdtsc();
+	
+	if (user) {
+		cpu->task->utime += now - cpu->acct_stamp;
+	} else {
+		cpu->task->stime += now - cpu->acct_stamp;
+	}
+	
+	cpu->acct_stamp = now;
+}
+
+void
+task_times(struct task_times *times)
+{
+	u32 flags = irq_save();
+	u64 idle = 0;
+	
+	task_account(0);
+	
+	for (u32 i = 0; i < cpu_count; i++) {
+		idle += cpus[i].idle->stime;
+	}
+	
+	times->utime = tsc_to_us(current_task->utime);
+	times->stime = tsc_to_us(current_task->stime);
+	times->idle = tsc_to_us(idle);
+	
+	irq_restore(flags);
+}
+
+task_header_t *
+task_find_own(u32 pid)
+{
+	task_header_t *task = current_task;
+	
+	do {
+		if (task->info.pid == pid &&
+			(task == current_task || task->parent == current_task)) {
+			return task;
+		}
 		
-	new_header->info.cr3 = copy_current_pagedir();
+		task = task->next;
+	} while (task != current_task);
 	
-	current_task->next = new_header;
-	current_task->next->next = current_task;
+	return 0;
+}
+
+void
+task_exit()
+{
+	task_header_t *task = current_task;
+	task_header_t *prev = task;
+	
+	if (task->next == task) {
+		panic("Last task exited");
+	}
+	
+	reap_dead_task();
+	
+	while (prev->next != task) {
+		prev = prev->next;
+	}
+	
+	prev->next = task->next;
+	
+	/* The task structure may be reused, forget it was a parent */
+	task_header_t *t = prev;
+	do {
+		if (t->parent == task)
+			t->parent = 0;
+		t = t->next;
+	} while (t != prev);
+	
+	uffd_release(task);
+	vm_free_areas(task->vm_areas);
+	arena_release(&task->scratch);
+	fpu_release(task);
+	sched_exit(task);
+	
+	task->state = TASK_DEAD;
+	this_cpu()->dead_task = task;
+	
+	schedule();
+	panic("Dead task scheduled");
+}
+
+void
+task_block()
+{
+	current_task->state = TASK_BLOCKED;
+	trace_sched_block(current_task);
+	sched_block(current_task);
+	schedule();
+}
+
+void
+task_wake(task_header_t *task)
+{
+	u32 flags = irq_save();
 	
-	new_header->info.regs.eax = 0;
-	current_task->info.regs.eax = 1;
+	if (task->state == TASK_BLOCKED) {
+		task->state = TASK_RUNNING;
+		trace_sched_wakeup(task);
+		sched_enqueue(task);
+	}
 	
-	do_sched();
+	irq_restore(flags);
 }
@@ -13,39 +13,35 @@ EFLAGS_IOPL3    equ (0x3000)
 
 SECTION .text
 
-GLOBAL user_space_switch, tss_flush, vm86_jump, vm86_bios, execute_task
+GLOBAL user_space_switch, tss_flush, vm86_jump, vm86_bios, switch_context
 GLOBAL __out_of_vm86
-EXTERN kprintf, tasking_set_esp0, vm86tss_set_esp, out_of_vm86
-EXTERN enable_irq
+EXTERN kprintf, vm86tss_set_esp, out_of_vm86
 
 tss_flush:
     mov ax, 0x2B
     ltr ax
     ret
 
-; void __sched(task_info_t info);
-execute_task:
-    add esp, 12                 ; Skip return-EIP, PID and CR3
-	mov ebp, esp
-	
-    mov al, 0x20
-    out 0x20, al
-    mov eax, [ebp + 11*4]       ; Use SS as the others segment registers.
-                                ; (8 for regs structures, and 3 for EIP, CS
-                                ;  EFLAGS)
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+; void switch_context(u32 *prev_esp, u32 next_esp);
+; Only the callee-saved registers are kept on the stack of the previous task,
+; the rest of its state is on the same stack, saved by isr_common.
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
 
-    popa
-    push DWORD [esp + 3*4]      ; SS
-    push DWORD [esp + 5*4]      ; ESP
-    pushf                       ; EFLAGS
-    or DWORD [esp], EFLAGS_IF   ; Set IF flag
-    push DWORD [esp + 5*4]      ; CS
-    push DWORD [esp + 5*4]      ; EIP
-    iret
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp
+    mov esp, edx
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
 
 ; void vm86_jump(struct regs r, u32 ip, u32 cs, u32 sp);
 vm86_jump:
@@ -90,6 +86,8 @@ __out_of_vm86:
     mov es, ax
     mov ss, ax
     mov fs, ax
+    mov ax, 0x30                ; CPU_SEL
+    mov gs, ax
 
     push ebp
     add esp, 4
@@ -108,10 +106,6 @@ user_space_switch:
     add esp, 4					; Skip return eip
     mov ebp, esp
     
-    push 0						; IRQ number to enable
-    call enable_irq
-    add esp, 4					; Erase enable_irq argument
-	
     xor eax, eax                ; Erase all registers
     mov ebx, eax
     mov ecx, eax
@@ -0,0 +1,482 @@
+#include <alien/timer.h>
+#include <alien/task.h>
+#include <alien/sched.h>
+#include <alien/apic.h>
+#include <alien/smp.h>
+#include <alien/irq.h>
+#include <alien/preempt.h>
+#include <alien/softirq.h>
+#include <alien/profile.h>
+#include <alien/kernel.h>
+
+#define PIT_CHANNEL0		0x40
+#define PIT_CHANNEL2		0x42
+#define PIT_COMMAND			0x43
+#define PIT_GATE			0x61	/* Channel 2 gate and output, speaker */
+#define PIT_RATE_GENERATOR	0x34	/* Channel 0, lobyte/hibyte, mode 2 */
+#define PIT_ONESHOT_CH2		0xB0	/* Channel 2, lobyte/hibyte, mode 0 */
+
+#define CALIBRATION_MS		10
+
+/* Longest time without a timer interrupt in one-shot mode */
+#define CLOCK_MAX_IDLE		(10 * HZ)
+
+/* Longer sleeps are split, time_before() can't order times 2^31 ticks apart
+ * and timer_jiffies may lag behind jiffies */
+#define SLEEP_MAX_TICKS		(1U << 30)
+
+/* The first level has one bucket per tick, the others TVN_SIZE buckets of
+ * TVR_SIZE times the span of the previous level */
+#define TVR_BITS			8
+#define TVN_BITS			6
+#define TVR_SIZE			(1 << TVR_BITS)
+#define TVN_SIZE			(1 << TVN_BITS)
+#define TVR_MASK			(TVR_SIZE - 1)
+#define TVN_MASK			(TVN_SIZE - 1)
+#define TVN_COUNT			4
+
+#define TVN_SHIFT(n)		(TVR_BITS + (n) * TVN_BITS)
+#define TVN_INDEX(j, n)		(((j) >> TVN_SHIFT(n)) & TVN_MASK)
+
+volatile u32 jiffies = 0;
+u32 tsc_khz = 0;
+
+/*
+ * With a local APIC, the timer interrupt is only programmed for the next
+ * event and jiffies are derived from the TSC.
+ */
+static u8 oneshot = 0;
+static u32 tsc_per_jiffy = 0;
+static u64 last_tsc = 0;		/* TSC at the start of the current jiffy */
+static u32 max_idle = 0;
+static u32 programmed = 0;		/* Jiffy of the boot CPU's next interrupt */
+
+static struct timer_link tv1[TVR_SIZE];
+static struct timer_link tvn[TVN_COUNT][TVN_SIZE];
+
+/* Next tick to run the timers of */
+static u32 timer_jiffies = 0;
+
+static inline void
+link_init(struct timer_link *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static inline void
+link_add_tail(struct timer_link *head, struct timer_link *link)
+{
+	link->next = head;
+	link->prev = head->prev;
+	head->prev->next = link;
+	head->prev = link;
+}
+
+static inline void
+link_del(struct timer_link *link)
+{
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->next = 0;
+	link->prev = 0;
+}
+
+static void
+internal_add_timer(struct timer *timer)
+{
+	u32 expires = timer->expires;
+	u32 delta = expires - timer_jiffies;
+	struct timer_link *head;
+	
+	if ((i32) delta < 0) {
+		/* Already due, run it on the next tick */
+		head = &tv1[timer_jiffies & TVR_MASK];
+	} else if (delta < TVR_SIZE) {
+		head = &tv1[expires & TVR_MASK];
+	} else {
+		int n = 0;
+		
+		while (n < TVN_COUNT - 1 && delta >= 1U << TVN_SHIFT(n + 1)) {
+			n++;
+		}
+		
+		head = &tvn[n][TVN_INDEX(expires, n)];
+	}
+	
+	link_add_tail(head, &timer->link);
+}
+
+/* Move the timers of the current bucket of level @n down to the lower levels,
+ * return the bucket index */
+static u32
+cascade(int n)
+{
+	u32 index = TVN_INDEX(timer_jiffies, n);
+	struct timer_link list = tvn[n][index];
+	
+	if (list.next == &tvn[n][index]) {
+		return index;
+	}
+	
+	/* Take the whole list out before adding the timers back */
+	list.next->prev = &list;
+	list.prev->next = &list;
+	link_init(&tvn[n][index]);
+	
+	while (list.next != &list) {
+		struct timer *timer = (struct timer *) list.next;
+		link_del(&timer->link);
+		internal_add_timer(timer);
+	}
+	
+	return index;
+}
+
+static void
+run_timers()
+{
+	u32 flags = irq_save();
+	
+	while (time_after_eq(jiffies, timer_jiffies)) {
+		u32 index = timer_jiffies & TVR_MASK;
+		
+		if (index == 0) {
+			for (int n = 0; n < TVN_COUNT && cascade(n) == 0; n++);
+		}
+		
+		timer_jiffies++;
+		
+		struct timer_link *head = &tv1[index];
+		
+		while (head->next != head) {
+			struct timer *timer = (struct timer *) head->next;
+			
+			link_del(&timer->link);
+			
+			irq_restore(flags);
+			timer->fn(timer);
+			flags = irq_save();
+		}
+	}
+	
+	irq_restore(flags);
+}
+
+/*
+ * Return the first jiffy before @limit at which run_timers() may have work:
+ * a timer due in the first level, or the cascade of a higher level bucket.
+ */
+static u32
+next_timer_jiffies(u32 limit)
+{
+	u32 next = limit;
+	
+	for (u32 j = timer_jiffies; time_before(j, timer_jiffies + TVR_SIZE) &&
+		 time_before(j, next); j++) {
+		struct timer_link *head = &tv1[j & TVR_MASK];
+		
+		if (head->next != head) {
+			next = j;
+			break;
+		}
+	}
+	
+	for (int n = 0; n < TVN_COUNT; n++) {
+		u32 span = 1U << TVN_SHIFT(n);
+		u32 cascade_at = (timer_jiffies + span - 1) & ~(span - 1);
+		
+		for (int k = 0; k < TVN_SIZE && time_before(cascade_at, next);
+			 k++, cascade_at += span) {
+			struct timer_link *head = &tvn[n][TVN_INDEX(cascade_at, n)];
+			
+			if (head->next != head) {
+				next = cascade_at;
+				break;
+			}
+		}
+	}
+	
+	return next;
+}
+
+/* Bring jiffies up to date */
+static void
+clock_update()
+{
+	if (!oneshot) {
+		jiffies++;
+		return;
+	}
+	
+	u64 delta = rdtsc() - last_tsc;
+	
+	if ((delta >> 32) >= tsc_per_jiffy) {
+		delta = (u64) max_idle * tsc_per_jiffy;
+	}
+	
+	u32 elapsed = div64_32(delta, tsc_per_jiffy, 0);
+	
+	last_tsc += (u64) elapsed * tsc_per_jiffy;
+	jiffies += elapsed;
+}
+
+void
+clock_program()
+{
+	if (!oneshot) {
+		return;
+	}
+	
+	u32 flags = irq_save();
+	int timer_cpu = this_cpu() == boot_cpu();
+	
+	/* Timers are left to the boot CPU, the others only wake up for their
+	 * own tasks */
+	u32 target = timer_cpu ? next_timer_jiffies(jiffies + max_idle)
+						   : jiffies + max_idle;
+	
+	task_header_t *task = current_task;
+	int running = task && task->state == TASK_RUNNING &&
+		!(task->flags & TASK_IDLE);
+	
+	/* Only a running task needs the tick, to end its time slice */
+	if (running && !task->dl.bw) {
+		u32 slice_end = jiffies + (task->timeslice ? task->timeslice : 1);
+		
+		if (time_before(slice_end, target)) {
+			target = slice_end;
+		}
+	}
+	
+	if (timer_cpu) {
+		programmed = target;
+	}
+	
+	u64 target_tsc = last_tsc;
+	
+	if (time_after(target, jiffies)) {
+		target_tsc += (u64) (target - jiffies) * tsc_per_jiffy;
+	}
+	
+	/* The profiler needs an interrupt for each sample */
+	u64 sample = profile_next_sample();
+	
+	if (sample && sample < target_tsc) {
+		target_tsc = sample;
+	}
+	
+	/* A deadline task is stopped as soon as its runtime is used up */
+	if (running && task->dl.bw && task->dl.stamp + task->dl.budget < target_tsc) {
+		target_tsc = task->dl.stamp + task->dl.budget;
+	}
+	
+	u64 now = rdtsc();
+	u32 count = 1;
+	
+	if (target_tsc > now) {
+		count = div64_32((target_tsc - now) * lapic_ticks_per_jiffy,
+						 tsc_per_jiffy, 0);
+	}
+	
+	lapic_timer_oneshot(count ? count : 1);
+	irq_restore(flags);
+}
+
+void
+timer_interrupt()
+{
+	struct cpu *cpu = this_cpu();
+	
+	clock_update();
+	
+	/* jiffies may have been updated by other CPUs */
+	u32 elapsed = jiffies - cpu->tick_jiffies;
+	cpu->tick_jiffies = jiffies;
+	
+	if (current_task && sched_tick(current_task, elapsed)) {
+		set_need_resched();
+	}
+	
+	raise_softirq(SOFTIRQ_TIMER);
+	
+	/* The softirq programs the interrupt again once the timers ran, but it
+	 * can be left pending by do_softirq() or wait for an exit with
+	 * interrupts enabled. Without this, a one-shot CPU could get no timer
+	 * interrupt anymore. */
+	clock_program();
+}
+
+/* Bottom half of the timer interrupt */
+static void
+timer_softirq()
+{
+	run_timers();
+	clock_program();
+}
+
+void
+pit_delay_ms(u32 ms)
+{
+	u32 count = PIT_FREQUENCY * ms / 1000;
+	
+	/* Gate channel 2 on with the speaker off, its output goes high once
+	 * the count reaches 0 */
+	outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+	outb(PIT_COMMAND, PIT_ONESHOT_CH2);
+	outb(PIT_CHANNEL2, count & 0xFF);
+	outb(PIT_CHANNEL2, count >> 8);
+	
+	while (!(inb(PIT_GATE) & 0x20));
+}
+
+u64
+tsc_to_us(u64 cycles)
+{
+	return tsc_khz ? udiv64(cycles * 1000, tsc_khz) : 0;
+}
+
+u64
+us_to_tsc(u32 us)
+{
+	return udiv64((u64) us * tsc_khz, 1000);
+}
+
+u32
+tsc_to_jiffies(u64 cycles)
+{
+	return div64_32(cycles + tsc_per_jiffy - 1, tsc_per_jiffy, 0);
+}
+
+static void
+tsc_calibrate()
+{
+	u64 start = rdtsc();
+	
+	pit_delay_ms(CALIBRATION_MS);
+	
+	tsc_khz = (u32) (rdtsc() - start) / CALIBRATION_MS;
+	tsc_per_jiffy = div64_32((u64) tsc_khz * 1000, HZ, 0);
+}
+
+void
+time_init()
+{
+	u32 divisor = PIT_FREQUENCY / HZ;
+	
+	for (int i = 0; i < TVR_SIZE; i++) {
+		link_init(&tv1[i]);
+	}
+	
+	for (int n = 0; n < TVN_COUNT; n++) {
+		for (int i = 0; i < TVN_SIZE; i++) {
+			link_init(&tvn[n][i]);
+		}
+	}
+	
+	open_softirq(SOFTIRQ_TIMER, timer_softirq);
+	tsc_calibrate();
+	
+	if (tsc_per_jiffy && lapic_init() == 0) {
+		max_idle = 0xFFFFFFFF / lapic_ticks_per_jiffy - 1;
+		
+		if (max_idle > CLOCK_MAX_IDLE) {
+			max_idle = CLOCK_MAX_IDLE;
+		}
+		
+		oneshot = 1;
+		last_tsc = rdtsc();
+		clock_program();
+		return;
+	}
+	
+	outb(PIT_COMMAND, PIT_RATE_GENERATOR);
+	outb(PIT_CHANNEL0, divisor & 0xFF);
+	outb(PIT_CHANNEL0, divisor >> 8);
+	
+	register_irq(IRQ_TIMER, timer_interrupt);
+}
+
+void
+timer_init(struct timer *timer, timer_fn_t fn, void *data)
+{
+	timer->link.next = 0;
+	timer->link.prev = 0;
+	timer->fn = fn;
+	timer->data = data;
+}
+
+void
+timer_add(struct timer *timer, u32 expires)
+{
+	u32 flags = irq_save();
+	
+	if (timer_pending(timer)) {
+		link_del(&timer->link);
+	}
+	
+	timer->expires = expires;
+	internal_add_timer(timer);
+	
+	/* The interrupt may be programmed later than the new timer */
+	if (oneshot && time_before(expires, programmed)) {
+		if (this_cpu() == boot_cpu()) {
+			clock_program();
+		} else {
+			smp_send_resched(boot_cpu());
+		}
+	}
+	
+	irq_restore(flags);
+}
+
+int
+timer_cancel(struct timer *timer)
+{
+	u32 flags = irq_save();
+	int pending = timer_pending(timer);
+	
+	if (pending) {
+		link_del(&timer->link);
+	}
+	
+	irq_restore(flags);
+	
+	return pending;
+}
+
+static void
+wake_sleeper(struct timer *timer)
+{
+	task_wake((task_header_t *) timer->data);
+}
+
+static void
+sleep_bounded(u32 ticks)
+{
+	struct timer timer;
+	u32 flags = irq_save();
+	u32 expires = jiffies + ticks;
+	
+	timer_init(&timer, wake_sleeper, current_task);
+	timer_add(&timer, expires);
+	
+	/* Other wake ups don't end the sleep */
+	while (time_before(jiffies, expires)) {
+		task_block();
+	}
+	
+	timer_cancel(&timer);
+	irq_restore(flags);
+}
+
+void
+sleep_ticks(u32 ticks)
+{
+	while (ticks > SLEEP_MAX_TICKS) {
+		sleep_bounded(SLEEP_MAX_TICKS);
+		ticks -= SLEEP_MAX_TICKS;
+	}
+	
+	sleep_bounded(ticks);
+}
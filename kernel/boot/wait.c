@@ -0,0 +1,147 @@
+#include <alien/wait.h>
+#include <alien/task.h>
+#include <alien/timer.h>
+#include <alien/smp.h>
+
+void
+wait_queue_init(wait_queue_t *wq)
+{
+	wq->head = 0;
+	wq->tail = 0;
+}
+
+void
+wait_on(wait_queue_t *wq)
+{
+	if (!current_task) {
+		cpu_halt();
+		return;
+	}
+	
+	current_task->wait_next = 0;
+	
+	if (wq->tail)
+		wq->tail->wait_next = current_task;
+	else
+		wq->head = current_task;
+	
+	wq->tail = current_task;
+	
+	task_block();
+}
+
+int
+wake_up(wait_queue_t *wq)
+{
+	u32 flags = irq_save();
+	task_header_t *task = wq->head;
+	
+	if (task) {
+		wq->head = task->wait_next;
+		if (!wq->head)
+			wq->tail = 0;
+		
+		task_wake(task);
+	}
+	
+	irq_restore(flags);
+	
+	return task != 0;
+}
+
+/* Unlink @task if it's still queued, after another kind of wake up */
+static void
+wait_queue_remove(wait_queue_t *wq, task_header_t *task)
+{
+	task_header_t *prev = 0;
+	
+	for (task_header_t *t = wq->head; t; prev = t, t = t->wait_next) {
+		if (t != task)
+			continue;
+		
+		if (prev)
+			prev->wait_next = t->wait_next;
+		else
+			wq->head = t->wait_next;
+		
+		if (wq->tail == t)
+			wq->tail = prev;
+		return;
+	}
+}
+
+void
+wake_up_all(wait_queue_t *wq)
+{
+	while (wake_up(wq));
+}
+
+void
+init_completion(struct completion *c)
+{
+	c->done = 0;
+	wait_queue_init(&c->wait);
+}
+
+void
+reinit_completion(struct completion *c)
+{
+	c->done = 0;
+}
+
+void
+complete(struct completion *c)
+{
+	u32 flags = irq_save();
+	
+	c->done++;
+	wake_up(&c->wait);
+	
+	irq_restore(flags);
+}
+
+void
+wait_for_completion(struct completion *c)
+{
+	u32 flags = irq_save();
+	
+	while (!c->done)
+		wait_on(&c->wait);
+	
+	c->done--;
+	irq_restore(flags);
+}
+
+static void
+timeout_wake(struct timer *timer)
+{
+	if (timer->data)
+		task_wake((task_header_t *) timer->data);
+}
+
+int
+wait_for_completion_timeout(struct completion *c, u32 ticks)
+{
+	u32 flags = irq_save();
+	u32 expires = jiffies + ticks;
+	struct timer timer;
+	
+	timer_init(&timer, timeout_wake, current_task);
+	timer_add(&timer, expires);
+	
+	while (!c->done && time_before(jiffies, expires)) {
+		wait_on(&c->wait);
+		if (current_task)
+			wait_queue_remove(&c->wait, current_task);
+	}
+	
+	timer_cancel(&timer);
+	
+	int done = c->done > 0;
+	if (done)
+		c->done--;
+	
+	irq_restore(flags);
+	
+	return done;
+}
@@ -0,0 +1,103 @@
+#include <alien/workqueue.h>
+#include <alien/task.h>
+#include <alien/wait.h>
+#include <alien/memory/kmalloc.h>
+
+#define SYSTEM_WQ_WORKERS	2
+
+struct workqueue {
+	struct work *head, *tail;
+	wait_queue_t wait;			/* Idle workers */
+};
+
+struct workqueue *system_wq = 0;
+
+static void
+worker_thread(void *arg)
+{
+	struct workqueue *wq = (struct workqueue *) arg;
+	
+	while (1) {
+		u32 flags = irq_save();
+		
+		while (!wq->head)
+			wait_on(&wq->wait);
+		
+		struct work *work = wq->head;
+		wq->head = work->next;
+		if (!wq->head)
+			wq->tail = 0;
+		work->pending = 0;
+		
+		irq_restore(flags);
+		
+		work->fn(work);
+	}
+}
+
+struct workqueue *
+workqueue_create(u32 workers)
+{
+	struct workqueue *wq = (struct workqueue *) kmalloc(sizeof(struct workqueue));
+	if (!wq)
+		return 0;
+	
+	wq->head = 0;
+	wq->tail = 0;
+	wait_queue_init(&wq->wait);
+	
+	/* Workers never exit, so the queue is never freed once one runs */
+	for (u32 i = 0; i < workers; i++) {
+		if (!kthread_create(worker_thread, wq)) {
+			if (i == 0) {
+				kfree(wq);
+				return 0;
+			}
+			break;
+		}
+	}
+	
+	return wq;
+}
+
+void
+workqueue_init()
+{
+	system_wq = workqueue_create(SYSTEM_WQ_WORKERS);
+	
+	if (!system_wq) {
+		kprintf("[ERROR] workqueue_init: can't start the system workers\n");
+	}
+}
+
+int
+queue_work(struct workqueue *wq, struct work *work)
+{
+	u32 flags = irq_save();
+	
+	if (work->pending) {
+		irq_restore(flags);
+		return 0;
+	}
+	
+	work->pending = 1;
+	work->next = 0;
+	
+	if (wq->tail)
+		wq->tail->next = work;
+	else
+		wq->head = work;
+	
+	wq->tail = work;
+	wake_up(&wq->wait);
+	
+	irq_restore(flags);
+	
+	return 1;
+}
+
+int
+schedule_work(struct work *work)
+{
+	return queue_work(system_wq, work);
+}
@@ -0,0 +1,95 @@
+#include <alien/ksyms.h>
+#include <alien/kernel.h>
+
+#define SHT_SYMTAB		2
+#define STT_FUNC		2
+#define ELF32_ST_TYPE(i)	((i) & 0xF)
+
+typedef struct {
+	u32 sh_name;
+	u32 sh_type;
+	u32 sh_flags;
+	u32 sh_addr;
+	u32 sh_offset;
+	u32 sh_size;
+	u32 sh_link;
+	u32 sh_info;
+	u32 sh_addralign;
+	u32 sh_entsize;
+} __attribute__((packed)) elf32_shdr_t;
+
+typedef struct {
+	u32 st_name;
+	u32 st_value;
+	u32 st_size;
+	u8  st_info;
+	u8  st_other;
+	u16 st_shndx;
+} __attribute__((packed)) elf32_sym_t;
+
+/* Physical addresses, mapped once init_paging() is done */
+static u32 symtab = 0;
+static u32 symtab_count = 0;
+static u32 strtab = 0;
+
+/* Only the boot 4MB mapping is available before init_paging() */
+#define BOOT_MAPPED_END		0x400000
+
+void
+ksyms_init(struct mb_info *mbi)
+{
+	if (!MB_CHECK_FLAG(mbi->flags, 5))
+		return;
+	
+	struct mb_elf_section_header_table *sec = &mbi->u.elf_sec;
+	
+	if (sec->addr + sec->num * sec->size > BOOT_MAPPED_END)
+		return;
+	
+	for (u32 i = 0; i < sec->num; i++) {
+		elf32_shdr_t *sh = (elf32_shdr_t *) (sec->addr + i * sec->size + kinfo.vbase);
+		
+		if (sh->sh_type != SHT_SYMTAB || sh->sh_link >= sec->num)
+			continue;
+		
+		elf32_shdr_t *str = (elf32_shdr_t *) (sec->addr + sh->sh_link * sec->size
+											  + kinfo.vbase);
+		u32 end = sh->sh_addr + sh->sh_size;
+		
+		if (str->sh_addr + str->sh_size > end)
+			end = str->sh_addr + str->sh_size;
+		
+		if (end > BOOT_MAPPED_END)
+			return;
+		
+		if (end > kinfo.len)
+			kinfo.len = end;
+		
+		symtab = sh->sh_addr;
+		symtab_count = sh->sh_size / sizeof(elf32_sym_t);
+		strtab = str->sh_addr;
+		return;
+	}
+}
+
+const char *
+ksym_lookup(u32 addr, u32 *offset)
+{
+	elf32_sym_t *syms = (elf32_sym_t *) (symtab + kinfo.vbase);
+	elf32_sym_t *best = 0;
+	
+	for (u32 i = 0; i < symtab_count; i++) {
+		if (ELF32_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_value > addr)
+			continue;
+		
+		if (!best || syms[i].st_value > best->st_value)
+			best = &syms[i];
+	}
+	
+	if (!best)
+		return 0;
+	
+	*offset = addr - best->st_value;
+	
+	return (const char *) (strtab + kinfo.vbase + best->st_name);
+}
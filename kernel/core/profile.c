@@ -0,0 +1,238 @@
+#include <alien/profile.h>
+#include <alien/task.h>
+#include <alien/smp.h>
+#include <alien/timer.h>
+#include <alien/ksyms.h>
+#include <alien/serial.h>
+#include <alien/preempt.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/vmalloc.h>
+
+#define EFLAGS_VM		(1 << 17)
+
+struct profile_sample {
+	u32 eip;
+	u32 pid;
+	u8  user;
+	u8  depth;
+	u32 chain[PROFILE_DEPTH];	/* Return addresses, innermost first */
+};
+
+/* Written by the timer interrupt of its CPU, read by profile_dump() */
+struct profile_ring {
+	u32                   head, tail;
+	u32                   lost;
+	struct profile_sample samples[PROFILE_RING_SIZE];
+};
+
+static struct profile_ring *rings = 0;
+static u8 running = 0;
+static u64 period = 0;				/* Between two samples, in TSC cycles */
+static u64 next_sample[MAX_CPUS];
+
+int
+profile_start(u32 hz)
+{
+	if (hz == 0) {
+		hz = PROFILE_HZ_DEFAULT;
+	}
+	
+	if (hz > PROFILE_HZ_MAX || !tsc_khz) {
+		return -1;
+	}
+	
+	/* Once allocated for every CPU, the rings are kept for the next runs */
+	if (!rings) {
+		rings = (struct profile_ring *) vmalloc(MAX_CPUS * sizeof(struct profile_ring));
+		
+		if (!rings) {
+			return -1;
+		}
+		
+		for (u32 i = 0; i < MAX_CPUS; i++) {
+			rings[i].head = 0;
+			rings[i].tail = 0;
+			rings[i].lost = 0;
+		}
+	}
+	
+	u32 flags = irq_save();
+	u64 now = rdtsc();
+	
+	period = udiv64((u64) tsc_khz * 1000, hz);
+	
+	for (u32 i = 0; i < cpu_count; i++) {
+		next_sample[i] = now + period;
+	}
+	
+	running = 1;
+	clock_program();
+	
+	/* The other CPUs reprogram their timer on the IPI */
+	for (u32 i = 0; i < cpu_count; i++) {
+		if (&cpus[i] != this_cpu()) {
+			smp_send_resched(&cpus[i]);
+		}
+	}
+	
+	irq_restore(flags);
+	
+	return 0;
+}
+
+void
+profile_stop()
+{
+	running = 0;
+}
+
+u64
+profile_next_sample()
+{
+	return running ? next_sample[this_cpu()->id] : 0;
+}
+
+/* Return 1 if the 8 bytes of a frame at @ebp are mapped in user space */
+static int
+user_frame_present(u32 ebp)
+{
+	if (ebp >= kinfo.vbase - 8 || (ebp & 3) || (ebp & (PAGE_SIZE - 1)) > PAGE_SIZE - 8) {
+		return 0;
+	}
+	
+	u32 *entry = page_entry(ebp & ~(PAGE_SIZE - 1));
+	
+	return entry && (*entry & (PAGE_PRESENT | PAGE_USER)) == (PAGE_PRESENT | PAGE_USER);
+}
+
+/* Follow the frame pointers from @ebp, a kernel stack frame must stay on
+ * the stack of @task */
+static u8
+walk_frames(u32 ebp, int user, task_header_t *task, u32 *chain)
+{
+	u8 depth = 0;
+	
+	while (depth < PROFILE_DEPTH) {
+		if (user) {
+			if (!user_frame_present(ebp))
+				break;
+		} else if (ebp < task->kstack || ebp > task->kstack + KERNEL_STACK_SIZE - 8 ||
+				   (ebp & 3)) {
+			break;
+		}
+		
+		u32 *frame = (u32 *) ebp;
+		
+		if (!frame[1])
+			break;
+		
+		chain[depth++] = frame[1];
+		
+		/* Stacks grow down, the caller's frame is above */
+		if (frame[0] <= ebp)
+			break;
+		
+		ebp = frame[0];
+	}
+	
+	return depth;
+}
+
+void
+profile_sample(const interrupt_frame_t *frame)
+{
+	struct cpu *cpu = this_cpu();
+	u64 now = rdtsc();
+	
+	if (!running || now < next_sample[cpu->id]) {
+		return;
+	}
+	
+	/* A late interrupt counts as one sample, not as all the ones missed */
+	next_sample[cpu->id] += period;
+	if (next_sample[cpu->id] <= now) {
+		next_sample[cpu->id] = now + period;
+	}
+	
+	struct profile_ring *ring = &rings[cpu->id];
+	
+	if (ring->head - ring->tail >= PROFILE_RING_SIZE) {
+		ring->lost++;
+		return;
+	}
+	
+	struct profile_sample *sample = &ring->samples[ring->head % PROFILE_RING_SIZE];
+	task_header_t *task = current_task;
+	int vm86 = frame->eflags & EFLAGS_VM;
+	
+	sample->eip = frame->eip;
+	sample->pid = task ? task->info.pid : 0;
+	sample->user = (frame->cs & 3) || vm86;
+	sample->depth = 0;
+	
+	if (task && !vm86) {
+		sample->depth = walk_frames(frame->regs.ebp, sample->user, task,
+									sample->chain);
+	}
+	
+	ring->head++;
+}
+
+static void
+print_frame(u32 addr, int user)
+{
+	u32 offset;
+	const char *name = user ? 0 : ksym_lookup(addr, &offset);
+	
+	if (name) {
+		serial_printf(";%s", name);
+	} else {
+		serial_printf(";0x%08x", addr);
+	}
+}
+
+void
+profile_dump()
+{
+	if (!rings) {
+		return;
+	}
+	
+	serial_puts("# prof\tcpu\tstack count\n");
+	
+	for (u32 i = 0; i < cpu_count; i++) {
+		struct profile_ring *ring = &rings[i];
+		
+		while (1) {
+			u32 flags = irq_save();
+			
+			if (ring->tail == ring->head) {
+				irq_restore(flags);
+				break;
+			}
+			
+			struct profile_sample sample = ring->samples[ring->tail % PROFILE_RING_SIZE];
+			ring->tail++;
+			irq_restore(flags);
+			
+			serial_printf("prof\t%u\tpid%u;%s", i, sample.pid,
+						  sample.user ? "user" : "kernel");
+			
+			for (int d = sample.depth - 1; d >= 0; d--) {
+				print_frame(sample.chain[d], sample.user);
+			}
+			
+			print_frame(sample.eip, sample.user);
+			serial_puts(" 1\n");
+			
+			/* Writing to the serial port takes long */
+			cond_resched();
+		}
+		
+		if (ring->lost) {
+			serial_printf("# cpu %u: %u samples lost, the ring was full\n",
+						  i, ring->lost);
+			ring->lost = 0;
+		}
+	}
+}
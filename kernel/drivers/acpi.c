@@ -0,0 +1,188 @@
+#include <alien/acpi.h>
+#include <alien/kernel.h>
+#include <alien/string.h>
+#include <alien/memory/vmalloc.h>
+
+#define EBDA_SEGMENT_PTR	0x40E
+#define EBDA_SEARCH_SIZE	1024
+#define BIOS_ROM_START		0xE0000
+#define BIOS_ROM_END		0x100000
+
+/* Larger tables are assumed to be garbage */
+#define ACPI_TABLE_MAX		0x10000
+
+#define MADT_LAPIC			0
+#define MADT_LAPIC_ENABLED	0x1
+
+struct rsdp {
+	char sig[8];
+	u8   checksum;
+	char oem[6];
+	u8   revision;
+	u32  rsdt;
+} __attribute__((packed));
+
+struct sdt_header {
+	char sig[4];
+	u32  length;
+	u8   revision;
+	u8   checksum;
+	char oem[6];
+	char oem_table[8];
+	u32  oem_revision;
+	u32  creator;
+	u32  creator_revision;
+} __attribute__((packed));
+
+struct madt {
+	struct sdt_header header;
+	u32               lapic_addr;
+	u32               flags;
+} __attribute__((packed));
+
+struct madt_entry {
+	u8 type;
+	u8 length;
+} __attribute__((packed));
+
+struct madt_lapic {
+	struct madt_entry entry;
+	u8                acpi_id;
+	u8                apic_id;
+	u32               flags;
+} __attribute__((packed));
+
+static u8
+checksum(const u8 *p, u32 len)
+{
+	u8 sum = 0;
+	
+	for (u32 i = 0; i < len; i++) {
+		sum += p[i];
+	}
+	
+	return sum;
+}
+
+/* Search the RSDP on 16 byte boundaries of low memory, mapped at vbase */
+static struct rsdp *
+find_rsdp_in(u32 start, u32 end)
+{
+	for (u32 p = start; p + sizeof(struct rsdp) <= end; p += 16) {
+		struct rsdp *rsdp = (struct rsdp *) (kinfo.vbase + p);
+		
+		if (!strncmp(rsdp->sig, "RSD PTR ", 8) &&
+			!checksum((u8 *) rsdp, sizeof(struct rsdp))) {
+			return rsdp;
+		}
+	}
+	
+	return 0;
+}
+
+static struct rsdp *
+find_rsdp()
+{
+	u32 ebda = *(u16 *) (kinfo.vbase + EBDA_SEGMENT_PTR) << 4;
+	struct rsdp *rsdp = 0;
+	
+	if (ebda) {
+		rsdp = find_rsdp_in(ebda, ebda + EBDA_SEARCH_SIZE);
+	}
+	
+	return rsdp ? rsdp : find_rsdp_in(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+/* Map the whole table at @phys, return 0 if it's invalid */
+static struct sdt_header *
+map_table(u32 phys)
+{
+	struct sdt_header *header = ioremap(phys, sizeof(struct sdt_header));
+	
+	if (!header) {
+		return 0;
+	}
+	
+	u32 length = header->length;
+	iounmap(header);
+	
+	if (length < sizeof(struct sdt_header) || length > ACPI_TABLE_MAX) {
+		return 0;
+	}
+	
+	header = ioremap(phys, length);
+	
+	if (header && checksum((u8 *) header, length)) {
+		iounmap(header);
+		return 0;
+	}
+	
+	return header;
+}
+
+static u32
+madt_cpus(struct madt *madt, u8 *apic_ids, u32 max)
+{
+	u8 *p = (u8 *) (madt + 1);
+	u8 *end = (u8 *) madt + madt->header.length;
+	u32 count = 0;
+	
+	while (p + sizeof(struct madt_entry) <= end) {
+		struct madt_entry *entry = (struct madt_entry *) p;
+		
+		if (entry->length < sizeof(struct madt_entry)) {
+			break;
+		}
+		
+		if (entry->type == MADT_LAPIC && count < max) {
+			struct madt_lapic *lapic = (struct madt_lapic *) entry;
+			
+			if (lapic->flags & MADT_LAPIC_ENABLED) {
+				apic_ids[count++] = lapic->apic_id;
+			}
+		}
+		
+		p += entry->length;
+	}
+	
+	return count;
+}
+
+u32
+acpi_madt_cpus(u8 *apic_ids, u32 max)
+{
+	struct rsdp *rsdp = find_rsdp();
+	
+	if (!rsdp) {
+		return 0;
+	}
+	
+	struct sdt_header *rsdt = map_table(rsdp->rsdt);
+	
+	if (!rsdt) {
+		kprintf("[ERROR] acpi: Invalid RSDT\n");
+		return 0;
+	}
+	
+	u32 *tables = (u32 *) (rsdt + 1);
+	u32 table_count = (rsdt->length - sizeof(struct sdt_header)) / sizeof(u32);
+	u32 count = 0;
+	
+	for (u32 i = 0; i < table_count && !count; i++) {
+		struct sdt_header *table = map_table(tables[i]);
+		
+		if (!table) {
+			continue;
+		}
+		
+		if (!strncmp(table->sig, "APIC", 4)) {
+			count = madt_cpus((struct madt *) table, apic_ids, max);
+		}
+		
+		iounmap(table);
+	}
+	
+	iounmap(rsdt);
+	
+	return count;
+}
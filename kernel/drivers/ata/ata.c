@@ -1,5 +1,10 @@
 #include <alien/kernel.h>
 #include <alien/ata.h>
+#include <alien/irq.h>
+#include <alien/wait.h>
+#include <alien/timer.h>
+#include <alien/preempt.h>
+#include <alien/softirq.h>
 
 #define ATA_DEVICE_COUNT 		4
 
@@ -14,6 +19,8 @@
 
 #define ATA_MASTER				0xA0
 
+#define ATA_TIMEOUT_MS			5000
+
 /* Bit 1 set for PI devices */
 #define ATA_TYPE_UNKNOWN    0
 #define ATA_TYPE_PATAPI     1
@@ -41,6 +48,14 @@ struct ata_data devices[ATA_DEVICE_COUNT] =
 	{ ATA_TYPE_UNKNOWN, 0x170, 0x376, 1 << 4, 0, 0, 0, 0 }
 };
 
+/* Signaled by the IRQ of each channel, primary then secondary */
+static struct completion ata_irq_done[2];
+
+/* The top halves only acknowledge the IRQ */
+static struct tasklet ata_irq_tasklet[2];
+
+#define ATA_CHANNEL(dev)	((dev)->base_port == 0x1F0 ? 0 : 1)
+
 extern void iowait(void);
 extern int ata_send_identify(struct ata_data *dev, u16 *buffer);
 
@@ -94,6 +109,26 @@ ata_identify(struct ata_data *dev)
     dev->lba28_total = *((u32*)(&buffer[60]));
 }
 
+static void
+ata_irq_complete(struct tasklet *tasklet)
+{
+    complete((struct completion *) tasklet->data);
+}
+
+static void
+ata_primary_irq()
+{
+    inb(devices[0].base_port + ATA_COMMAND_PORT);   /* Acknowledge */
+    tasklet_schedule(&ata_irq_tasklet[0]);
+}
+
+static void
+ata_secondary_irq()
+{
+    inb(devices[2].base_port + ATA_COMMAND_PORT);
+    tasklet_schedule(&ata_irq_tasklet[1]);
+}
+
 i32
 atapi_read(struct ata_data *dev, u32 lba, u8 *buffer, u16 maxlen)
 {
@@ -107,22 +142,27 @@ atapi_read(struct ata_data *dev, u32 lba, u8 *buffer, u16 maxlen)
     iowait();
     iowait();
         
+    struct completion *done = &ata_irq_done[ATA_CHANNEL(dev)];
+    
     outb(dev->base_port + ATA_FEAT_PORT, 0);
     outb(dev->base_port + ATA_LBAMID_PORT, maxlen & 0xFF);
     outb(dev->base_port + ATA_LBAHI_PORT, maxlen >> 8);
     outb(dev->base_port + ATA_COMMAND_PORT, 0xA0);
     
+    /* The device asks for the packet without raising an IRQ, and quickly */
     while ((status = inb(dev->base_port + ATA_COMMAND_PORT)) & 0x80)
-        ;
+        cond_resched();
     
     while (!((status = inb(dev->base_port + ATA_COMMAND_PORT)) & 0x8)
         && !(status & 0x1))
-        ;
+        cond_resched();
     
     if (status & 0x1) {
         return -1;
     }
     
+    reinit_completion(done);
+    
     read_cmd[9] = 1;
     read_cmd[2] = (lba >> 0x18) & 0xFF;
     read_cmd[3] = (lba >> 0x10) & 0xFF;
@@ -131,13 +171,22 @@ atapi_read(struct ata_data *dev, u32 lba, u8 *buffer, u16 maxlen)
     
     outsw(dev->base_port, (u16 *) read_cmd, 6);
     
+    /* Sleep until the data is ready, then until the command is over */
+    if (!wait_for_completion_timeout(done, msecs_to_jiffies(ATA_TIMEOUT_MS))) {
+        kprintf("[ERROR] atapi_read: timeout\n");
+        return -1;
+    }
+    
+    if (inb(dev->base_port + ATA_COMMAND_PORT) & 0x1) {
+        return -1;
+    }
+    
     size = (((u32) inb(dev->base_port + ATA_LBAHI_PORT)) << 8) |
            ((u32) inb(dev->base_port + ATA_LBAMID_PORT));
     
     insw(dev->base_port, (u16 *) buffer, size / 2);
     
-    while ((status = inb (dev->base_port + ATA_COMMAND_PORT)) & 0x88)
-        ;
+    wait_for_completion_timeout(done, msecs_to_jiffies(ATA_TIMEOUT_MS));
     
     return size;
 }
@@ -159,6 +208,13 @@ ata_read(struct device *dev, byte_t *out, int len)
 void
 ata_probe(struct device *dev)
 {
+    init_completion(&ata_irq_done[0]);
+    init_completion(&ata_irq_done[1]);
+    tasklet_init(&ata_irq_tasklet[0], ata_irq_complete, &ata_irq_done[0]);
+    tasklet_init(&ata_irq_tasklet[1], ata_irq_complete, &ata_irq_done[1]);
+    register_irq(IRQ_ATA_PRIMARY, ata_primary_irq);
+    register_irq(IRQ_ATA_SECONDARY, ata_secondary_irq);
+    
     for (int i = 1; i < ATA_DEVICE_COUNT; i++) {
         ata_detect(&devices[i]);
         ata_identify(&devices[i]);
@@ -5,12 +5,15 @@
 #include <list.h>
 #include <alien/ata.h>
 #include <alien/string.h>
+#include <alien/memory/slab.h>
 
 #define PCI_HEADER_IS_NORMAL(h)     (((h) & 0x0F) == 0x00)
 #define PCI_HEADER_IS_PCI_PCI(h)    (((h) & 0x0F) == 0x01)
 #define PCI_HEADER_IS_CARDBUS(h)    (((h) & 0x0F) == 0x02)
 #define PCI_HEADER_HAS_MULTI(h)     ((h) & (0x80))
 
+#define DRIVER_NAME_MAX             16
+
 
 static void pci_probe(struct device *dev);
 
@@ -18,14 +21,23 @@ static struct list_head *drivers;
 static struct driver pci_driver = { "pci", pci_probe };
 static struct device pci_bus;
 
+static struct kmem_cache *device_cache;
+static struct kmem_cache *pci_data_cache;
+static struct kmem_cache *driver_cache;
+static struct kmem_cache *driver_name_cache;
+
 
 static struct driver *
 load_driver(const char *name)
 {    
+    if (strlen(name) >= DRIVER_NAME_MAX) {
+        return (struct driver *) 0;
+    }
+
     if (strcmp(name, "ata") == 0) {
-        struct driver *driver = (struct driver *) kmalloc(sizeof(struct driver));
+        struct driver *driver = (struct driver *) kmem_cache_alloc(driver_cache);
 
-        driver->name = (char *) kmalloc(sizeof(char) * (strlen(name) + 1));
+        driver->name = (char *) kmem_cache_alloc(driver_name_cache);
         strcpy(driver->name, name);
         driver->probe = ata_probe;
         list_add(&drivers, driver);
@@ -108,14 +120,14 @@ probe_function(struct device *bus, u8 device, u8 function)
     base_class = (u8) (pci_read(bus_data->bus, device, function, 10) >> 8);
     sub_class = (u8) pci_read(bus_data->bus, device, function, 10);
     
-    struct device *dev = (struct device *) kmalloc(sizeof(struct device));
+    struct device *dev = (struct device *) kmem_cache_alloc(device_cache);
     dev->parent = bus;
     dev->children = 0;
     dev->read = 0;
     dev->driver = find_driver("pci");
     
     struct pci_device_data *data =
-        (struct pci_device_data *) kmalloc(sizeof(struct pci_device_data));
+        (struct pci_device_data *) kmem_cache_alloc(pci_data_cache);
     
     data->vendor_id = pci_read(bus_data->bus, device, function, 0);
     data->device_id = pci_read(bus_data->bus, device, function, 2);
@@ -155,6 +167,12 @@ pci_probe(struct device *dev)
 void
 pci_init()
 {
+    device_cache = kmem_cache_create("device", sizeof(struct device), 0, 0);
+    pci_data_cache = kmem_cache_create("pci_device_data",
+                                       sizeof(struct pci_device_data), 0, 0);
+    driver_cache = kmem_cache_create("driver", sizeof(struct driver), 0, 0);
+    driver_name_cache = kmem_cache_create("driver_name", DRIVER_NAME_MAX, 0, 0);
+
     list_add(&drivers, &pci_driver);
     
     pci_bus.parent = 0;
@@ -163,7 +181,7 @@ pci_init()
     pci_bus.driver = &pci_driver;
     
     struct pci_device_data *data = (struct pci_device_data *)
-        kmalloc(sizeof(struct pci_device_data));
+        kmem_cache_alloc(pci_data_cache);
     
     data->vendor_id = pci_read(0, 0, 0, 0);
     data->device_id = pci_read(0, 0, 0, 2);
@@ -0,0 +1,76 @@
+#include <alien/serial.h>
+#include <alien/kernel.h>
+#include <alien/io.h>
+
+#define COM1				0x3F8
+
+#define SERIAL_DATA			0
+#define SERIAL_IER			1
+#define SERIAL_FCR			2
+#define SERIAL_LCR			3
+#define SERIAL_MCR			4
+#define SERIAL_LSR			5
+
+#define LCR_DLAB			0x80
+#define LCR_8N1				0x03
+#define LSR_THR_EMPTY		0x20
+
+static u8 serial_ready = 0;
+
+void
+serial_init()
+{
+	outb(COM1 + SERIAL_IER, 0x00);
+	
+	/* Divisor 1 of the 115200 Hz base clock */
+	outb(COM1 + SERIAL_LCR, LCR_DLAB);
+	outb(COM1 + SERIAL_DATA, 0x01);
+	outb(COM1 + SERIAL_IER, 0x00);
+	outb(COM1 + SERIAL_LCR, LCR_8N1);
+	
+	/* Enable and clear the FIFOs, 14 bytes threshold */
+	outb(COM1 + SERIAL_FCR, 0xC7);
+	/* DTR, RTS and OUT2 */
+	outb(COM1 + SERIAL_MCR, 0x0B);
+	
+	serial_ready = 1;
+}
+
+void
+serial_putc(char c)
+{
+	if (!serial_ready) {
+		serial_init();
+	}
+	
+	if (c == '\n') {
+		serial_putc('\r');
+	}
+	
+	while (!(inb(COM1 + SERIAL_LSR) & LSR_THR_EMPTY));
+	
+	outb(COM1 + SERIAL_DATA, c);
+}
+
+void
+serial_puts(const char *s)
+{
+	while (*s) {
+		serial_putc(*s++);
+	}
+}
+
+int
+serial_printf(const char *format, ...)
+{
+	char buffer[SERIAL_PRINTF_MAX];
+	va_list args;
+	
+	va_start(args, format);
+	int ret = kvsprintf(buffer, format, args);
+	va_end(args);
+	
+	serial_puts(buffer);
+	
+	return ret;
+}
@@ -0,0 +1,13 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <types.h>
+
+/**
+ * Find the MADT and store the local APIC IDs of the enabled processors in
+ * @apic_ids, at most @max. Return how many were found, or 0 if there is no
+ * MADT.
+ */
+u32 acpi_madt_cpus(u8 *apic_ids, u32 max);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <types.h>
+
+/* Interrupt vectors of the local APIC, above the PIC ones. The spurious
+ * vector must end with 0xF on older APICs */
+#define LAPIC_TIMER_VECTOR		0x30
+#define LAPIC_RESCHED_VECTOR	0x31
+#define LAPIC_SPURIOUS_VECTOR	0x3F
+
+/**
+ * Map and enable the local APIC, and calibrate its timer against the PIT.
+ * Return -1 if there's no local APIC.
+ */
+int lapic_init();
+
+/**
+ * Enable the local APIC of an application processor, once lapic_init() ran
+ * on the boot processor.
+ */
+void lapic_enable();
+
+u8 lapic_id();
+void lapic_eoi();
+
+/**
+ * Send interrupt @vector to the CPU whose local APIC ID is @apic_id.
+ */
+void lapic_send_ipi(u8 apic_id, u8 vector);
+
+/**
+ * INIT and STARTUP IPIs, the latter starts the CPU in real mode at the page
+ * aligned physical address @page.
+ */
+void lapic_send_init(u8 apic_id);
+void lapic_send_startup(u8 apic_id, u32 page);
+
+/**
+ * Raise LAPIC_TIMER_VECTOR once, after @count timer ticks (0 stops it).
+ */
+void lapic_timer_oneshot(u32 count);
+
+/* Local APIC timer ticks in one jiffy, set by lapic_init() */
+extern u32 lapic_ticks_per_jiffy;
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <types.h>
+
+#define FPU_STATE_SIZE		512
+#define FPU_STATE_ALIGN		16
+
+struct task_header;
+
+/* x87, MMX and SSE registers as stored by FXSAVE */
+struct fpu_state {
+	u8 data[FPU_STATE_SIZE];
+} __attribute__((aligned(FPU_STATE_ALIGN)));
+
+/**
+ * Enable the FPU and SSE. Tasks get an FPU state on their first FPU
+ * instruction. Return -1 if the CPU has no FXSAVE or SSE, FPU instructions
+ * then kill the task.
+ */
+int fpu_init();
+
+/**
+ * Called when switching from @prev to @next. The registers of @prev are
+ * saved if it used them, those of @next are only loaded when it uses them,
+ * by fpu_trap().
+ */
+void fpu_switch(struct task_header *prev, struct task_header *next);
+
+/**
+ * Device not available (#NM) trap: load the FPU registers of the current
+ * task.
+ */
+void fpu_trap();
+
+/**
+ * Give @child a copy of the FPU state of @parent. Return -1 if there's not
+ * enough memory.
+ */
+int fpu_fork(struct task_header *parent, struct task_header *child);
+
+void fpu_release(struct task_header *task);
+
+/**
+ * Let the kernel use SSE registers until kernel_fpu_end(). The registers of
+ * user tasks are saved first, and interrupts are disabled, so keep these
+ * sections short. They don't nest.
+ */
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+/**
+ * Copy a page aligned page, with SSE if available.
+ */
+void copy_page(void *dest, const void *src);
+
+#endif
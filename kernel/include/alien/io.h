@@ -1,6 +1,8 @@
 #ifndef IO_H
 #define IO_H
 
+#include <stdarg.h>
+
 #define IO_BACKSPACE 0x08
 #define IO_TABULATOR 0x09
 #define IO_BLANK 0x20
@@ -11,5 +13,6 @@ void kcls();
 
 int kprintf(const char *format, ...);
 int ksprintf(char *out, const char *format, ...);
+int kvsprintf(char *out, const char *format, va_list args);
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <types.h>
+
+#define IRQ_TIMER			0
+#define IRQ_ATA_PRIMARY		14
+#define IRQ_ATA_SECONDARY	15
+
+typedef void (*irq_handler_t) (void);
+
+void enable_irq(u32 irq);
+
+/**
+ * Call @handler on each @irq, after the handlers already registered for it,
+ * and unmask the IRQ. Handlers run with interrupts disabled, and leave the
+ * rest of the work to a bottom half, see softirq.h.
+ */
+void register_irq(u32 irq, irq_handler_t handler);
+
+#endif
@@ -49,9 +49,82 @@ typedef struct {
 
 kernel_info_t kinfo;
 
+/* Return 1 if [@buf, @buf + @size) lies below the kernel, without overflow */
+static inline int
+user_range_ok(u32 buf, u32 size)
+{
+    return size <= kinfo.vbase && buf <= kinfo.vbase - size;
+}
+
 void panic(const char* msg);
 void dump_regs(struct regs r);
 
+#define EFLAGS_IF       (1 << 9)
+
+/* Disable interrupts and return the previous EFLAGS for irq_restore() */
+static inline u32
+irq_save()
+{
+    u32 flags;
+    asm volatile ("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void
+irq_restore(u32 flags)
+{
+    asm volatile ("push %0; popf" :: "r"(flags) : "memory", "cc");
+}
+
+static inline u64
+rdtsc()
+{
+    u32 lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64) hi << 32) | lo;
+}
+
+/* Divide @n by @d with a single div, the quotient must fit in 32 bits */
+static inline u32
+div64_32(u64 n, u32 d, u32 *rem)
+{
+    u32 q, r;
+    asm ("divl %4" : "=a"(q), "=d"(r) : "a"((u32) n), "d"((u32) (n >> 32)), "rm"(d));
+    if (rem)
+        *rem = r;
+    return q;
+}
+
+/* Divide @n by @d, with a 64 bit quotient */
+static inline u64
+udiv64(u64 n, u32 d)
+{
+    u32 high = (u32) (n >> 32);
+    u32 low = div64_32(((u64) (high % d) << 32) | (u32) n, d, 0);
+    return ((u64) (high / d) << 32) | low;
+}
+
+static inline void
+cpuid(u32 leaf, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
+{
+    asm volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                          : "a"(leaf), "c"(0));
+}
+
+static inline u64
+rdmsr(u32 msr)
+{
+    u32 lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((u64) hi << 32) | lo;
+}
+
+static inline void
+wrmsr(u32 msr, u64 value)
+{
+    asm volatile ("wrmsr" :: "c"(msr), "a"((u32) value), "d"((u32) (value >> 32)));
+}
+
 static inline void
 outb(u16 port, u8 data)
 {
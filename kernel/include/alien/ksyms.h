@@ -0,0 +1,20 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <types.h>
+#include <alien/boot/multiboot.h>
+
+/**
+ * Find the kernel symbol table in the ELF section headers passed by the
+ * bootloader, and keep it out of the frame allocator by extending
+ * kinfo.len. Must be called before init_paging().
+ */
+void ksyms_init(struct mb_info *mbi);
+
+/**
+ * Return the name of the function containing @addr and store the distance
+ * from its start in @offset, or return 0 if it's unknown.
+ */
+const char *ksym_lookup(u32 addr, u32 *offset);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include <types.h>
+
+/*
+ * Allocation profiler, built in when ALLOC_PROFILE is defined (see
+ * make.conf). kmalloc() and alloc_frame() account every allocation to the
+ * return address of their caller.
+ */
+
+#ifdef ALLOC_PROFILE
+
+#define PROFILE_KMALLOC		0
+#define PROFILE_FRAME		1
+
+#define PROFILE_CALLER()	((u32) __builtin_return_address(0))
+
+/**
+ * Account an allocation of @bytes made from @caller that took @cycles.
+ * Return the index of the call site, to be given back to profile_free()
+ * when the allocation is released, or 0 if the site table is full.
+ */
+u16 profile_alloc(u8 kind, u32 caller, u32 bytes, u64 cycles);
+void profile_free(u16 site, u32 bytes);
+
+/**
+ * Write one line per call site to the serial port, tab separated with a
+ * commented header so that it can be fed to sort(1).
+ */
+void alloc_profile_dump();
+void alloc_profile_reset();
+
+#endif
+
+#endif
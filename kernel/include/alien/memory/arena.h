@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <types.h>
+
+/*
+ * Region allocator for memory with a clear lifetime: allocations bump a
+ * pointer in page sized chunks and are all released at once, there is no
+ * per-object free.
+ */
+
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk *chunk;		/* Current chunk, linked to the older ones */
+	u32                 pos;		/* Next free byte of the current chunk */
+	u32                 end;
+};
+
+/* Position in an arena, see arena_save() */
+struct arena_mark {
+	struct arena_chunk *chunk;
+	u32                 pos;
+};
+
+void arena_init(struct arena *arena);
+
+/**
+ * Allocate @size bytes aligned on 8 bytes from @arena. Allocations larger
+ * than a chunk get a chunk of their own from vmalloc(). Return 0 if no
+ * page is available.
+ */
+void *arena_alloc(struct arena *arena, u32 size);
+
+/**
+ * arena_restore() frees everything allocated from @arena after the matching
+ * arena_save(), so that a function can use an arena it doesn't own as
+ * scratch space.
+ */
+struct arena_mark arena_save(const struct arena *arena);
+void arena_restore(struct arena *arena, struct arena_mark mark);
+
+/**
+ * Free every allocation but keep the first chunk for reuse.
+ */
+void arena_reset(struct arena *arena);
+
+/**
+ * Free every allocation and give all the chunks back.
+ */
+void arena_release(struct arena *arena);
+
+#endif
@@ -1,8 +1,58 @@
 #ifndef MALLOC_H
 #define MALLOC_H
 
+#include <types.h>
+
+struct kmalloc_stats {
+	u32 heap_size;		/* Bytes of pages mapped in the heap */
+	u32 heap_peak;		/* High-water mark of heap_size */
+	u32 used;			/* Bytes allocated, without block headers */
+	u32 used_peak;		/* High-water mark of used */
+	u32 grows;
+	u32 shrinks;
+};
+
+/**
+ * Allocate @s bytes, 8 bytes aligned, from the kernel heap in constant
+ * time. Return 0 if there is no free block large enough.
+ */
 void *kmalloc(unsigned int s);
+
+/**
+ * Allocate @s bytes aligned on @align, a power of two, from the kernel heap.
+ * The block is given back with kfree().
+ */
+void *kmalloc_aligned(unsigned int s, unsigned int align);
+
+/**
+ * Give a block returned by kmalloc() back to the heap. Adjacent free blocks
+ * are merged immediately.
+ */
+void kfree(void *p);
+
+/**
+ * The heap lives in [KHEAP_START, KHEAP_END) and starts with one page. It
+ * grows on demand with pages from the frame allocator.
+ */
 void
 kmalloc_init();
 
+/**
+ * Give the free pages at the end of the heap back to the frame allocator.
+ * Return the number of bytes released.
+ */
+u32 kmalloc_trim();
+
+void kmalloc_get_stats(struct kmalloc_stats *stats);
+
+#ifdef KMALLOC_SELFTEST
+/**
+ * Stress the heap with random allocations, frees and moves of random sizes
+ * and alignments, checking the free lists and the stats as it goes. Built
+ * in when KMALLOC_SELFTEST is defined (see make.conf). Return -1 if any
+ * check failed.
+ */
+int kmalloc_selftest();
+#endif
+
 #endif
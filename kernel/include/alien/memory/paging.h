@@ -3,6 +3,38 @@
 
 #include <types.h>
 
+#define PAGE_SIZE		0x1000
+
+/*
+ * Kernel address space ranges whose page tables are allocated at boot, so
+ * that they are shared by every page directory.
+ */
+#define KHEAP_START		0xD0000000
+#define KHEAP_END		0xD1000000
+#define VMALLOC_START	0xE0000000
+#define VMALLOC_END		0xE2000000
+
+/* The page directory maps itself in its last entry */
+#define CURRENT_PAGEDIR	((u32 *) 0xFFFFF000)
+
+#define PAGE_PRESENT	0x001
+#define PAGE_RW			0x002
+#define PAGE_USER		0x004
+#define PAGE_PWT		0x008
+#define PAGE_PCD		0x010
+#define PAGE_ACCESSED	0x020
+#define PAGE_DIRTY		0x040
+#define PAGE_SHARED		0x200	/* Available bit: frame is shared, not copied
+								   on fork */
+#define PAGE_AROUND		0x400	/* Available bit: mapped by fault-around */
+#define PAGE_FLAGS		0xFFF
+
+static inline void
+invlpg(u32 page)
+{
+	asm volatile ("invlpg (%0)" :: "r" (page) : "memory");
+}
+
 /**
  * Should be called before any other functions in this module.
  */
@@ -21,10 +53,70 @@ void free_page(u32 page);
 
 u32 alloc_page(u32 offset, u32 user);
 
+/**
+ * Physical frame allocator. Frames are reference counted: alloc_frame()
+ * returns a frame with one reference, get_frame() takes another one and
+ * put_frame() drops one, releasing the frame with the last reference.
+ * free_frame() releases the frame regardless of its references.
+ * get_frame() returns -1 if the frame has 255 references already.
+ */
+u32 alloc_frame();
+void free_frame(u32 frame);
+int get_frame(u32 frame);
+void put_frame(u32 frame);
+u32 frame_ref_count(u32 frame);
+
 void switch_page_dir(u32 dir);
 
+/**
+ * Return the frame of the boot page directory, which kernel threads use.
+ */
+u32 kernel_pagedir_frame();
+
+/**
+ * Return the frame of a new page directory sharing the kernel half of the
+ * current one. Released directories are recycled by create_user_pagedir().
+ */
 u32 create_user_pagedir();
+
+/**
+ * Release every user page and page table of the page directory
+ * @pagedir_frame, then the directory itself. It must not be the current one.
+ */
+void free_user_pagedir(u32 pagedir_frame);
 u32 map(u32 frame, u32 offset, u32 user);
+
+/**
+ * Map @frame at exactly @page in the current page directory with the PAGE_*
+ * @flags. Return 0 if the page is already mapped or a page table can't be
+ * allocated.
+ */
+u32 map_at(u32 page, u32 frame, u32 flags);
+
+/**
+ * Allocate the page tables covering [@start, @end) in the current page
+ * directory. Called at boot on kernel ranges so that page directories
+ * created afterwards share them.
+ */
+int reserve_kernel_range(u32 start, u32 end);
+
+/**
+ * Same as map_at() in the page directory @pagedir_frame, which doesn't need
+ * to be the current one.
+ */
+u32 map_in(u32 pagedir_frame, u32 page, u32 frame, u32 flags);
+
+/**
+ * Return a pointer to the page table entry of @page in the current page
+ * directory, or 0 if its page table doesn't exist.
+ */
+u32 *page_entry(u32 page);
+
+/**
+ * Return the frame filled with zeros that is mapped read-only in place of
+ * untouched anonymous pages. It isn't reference counted.
+ */
+u32 get_zero_frame();
 void unmap(u32 page);
 u32 phys_addr(u32 *dir, u32 page);
 u32 copy_current_pagedir();
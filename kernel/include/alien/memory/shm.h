@@ -0,0 +1,32 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <types.h>
+
+#define SHM_MAX			16
+#define SHM_NAME_MAX	32
+
+/**
+ * Open the shared memory object @name, creating it with @size bytes if it
+ * doesn't exist yet. Return the object id, or -1 on error.
+ */
+int shm_open(const char *name, u32 size);
+
+/**
+ * Map every page of the object @id into the current address space, starting
+ * at the page aligned user address @vaddr. Return 0 on success, -1 on error.
+ */
+int shm_attach(int id, u32 vaddr);
+
+/**
+ * Unmap the object @id previously attached at @vaddr.
+ */
+int shm_detach(int id, u32 vaddr);
+
+/**
+ * Remove the name of the object. Its frames are released once the last
+ * mapping is detached.
+ */
+int shm_unlink(const char *name);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <types.h>
+
+#define CACHE_LINE_SIZE		64
+
+/* kmem_cache_create() flags */
+#define SLAB_HWCACHE_ALIGN	0x1		/* Align objects on cache lines */
+
+typedef void (*kmem_ctor_t) (void *obj);
+
+struct kmem_cache;
+
+struct kmem_cache_stats {
+	const char *name;
+	u32         obj_size;		/* Size of an object, padding included */
+	u32         active_objs;	/* Allocated objects */
+	u32         total_objs;		/* Objects that fit in the cache's slabs */
+	u32         slabs;
+};
+
+/**
+ * Create a cache of objects of @size bytes. Each slab is one page of the
+ * kernel address space, so @size must leave room for at least one object.
+ * @ctor, if not 0, is called once on each object when its slab is created:
+ * objects must be given back to kmem_cache_free() in their constructed
+ * state.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, u32 size, u32 flags,
+									 kmem_ctor_t ctor);
+
+/**
+ * Allocate an object from @cache in constant time. Return 0 if no page can
+ * be allocated for a new slab.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+/**
+ * Give the pages of the empty slabs of @cache back to the page allocator.
+ */
+void kmem_cache_shrink(struct kmem_cache *cache);
+
+void kmem_cache_get_stats(const struct kmem_cache *cache,
+						  struct kmem_cache_stats *stats);
+
+/**
+ * Print the utilization of every cache.
+ */
+void kmem_cache_dump();
+
+#endif
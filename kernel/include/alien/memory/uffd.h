@@ -0,0 +1,61 @@
+#ifndef UFFD_H
+#define UFFD_H
+
+#include <types.h>
+
+struct task_header;
+
+#define UFFD_MAX			8
+#define UFFD_QUEUE_SIZE		16
+
+#define UFFD_EVENT_WRITE	0x1
+
+/**
+ * Message read by the fault handling task for each fault on a registered
+ * range.
+ */
+struct uffd_event {
+	u32 addr;		/* Page aligned faulting address */
+	u32 flags;		/* UFFD_EVENT_* */
+	u32 pid;		/* Faulting task */
+};
+
+/**
+ * Create a user fault handler for the address space of the current task.
+ * Return its id, or -1 on error.
+ */
+int uffd_create();
+
+/**
+ * Hand the faults on the pages of [@start, @start + @len) over to @id. The
+ * range must be covered by anonymous vm areas of the owner of @id.
+ */
+int uffd_register(int id, u32 start, u32 len);
+
+/**
+ * Pop the oldest fault of @id into @event. Return -1 if there is none, or if
+ * the current task is neither the owner of @id nor a child of it.
+ */
+int uffd_read(int id, struct uffd_event *event);
+
+/**
+ * Resolve a fault of @id: map a new page at @dst in the owner's address
+ * space, filled with the page at @src in the current one (or with zeros if
+ * @src is 0), and wake the owner up if it waited for @dst. @dst must be
+ * registered with @id and @src must be mapped user memory. Only the owner
+ * of @id and its children may call it.
+ */
+int uffd_copy(int id, u32 dst, u32 src);
+
+/**
+ * Called by vm_fault() on a registered page: queue an event and return 0 so
+ * the faulting task blocks until the fault is resolved, -1 on error.
+ */
+int uffd_handle_fault(int id, u32 addr, u32 err);
+
+/**
+ * Release the handlers owned by @task.
+ */
+void uffd_release(struct task_header *task);
+
+#endif
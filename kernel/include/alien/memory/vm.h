@@ -0,0 +1,108 @@
+#ifndef VM_H
+#define VM_H
+
+#include <types.h>
+#include <alien/vfs.h>
+
+#define VM_ANON		0x01	/* Zero filled on first access */
+#define VM_FILE		0x02	/* Filled from @file on first access */
+#define VM_SEQUENTIAL	0x04	/* Read ahead of faults, see vm_madvise() */
+#define VM_RANDOM		0x08	/* No fault-around */
+#define VM_UFFD			0x10	/* Faults are resolved by user space */
+
+/* vm_fault() return value when the faulting task must block */
+#define VM_FAULT_BLOCK	1
+
+/* vm_madvise() advices, same values as Linux */
+#define MADV_NORMAL		0
+#define MADV_RANDOM		1
+#define MADV_SEQUENTIAL	2
+#define MADV_WILLNEED	3
+#define MADV_DONTNEED	4
+
+#define VM_FAULT_AROUND_DEFAULT	16
+
+/**
+ * A range of the user address space whose pages are populated lazily by the
+ * page fault handler. Each task owns a list of non-overlapping areas.
+ */
+struct vm_area {
+	u32             start, end;		/* Page aligned, end excluded */
+	u32             flags;
+	vfs_node_t      file;
+	u32             offset;			/* Offset in @file of @start */
+	int             uffd;			/* Fault handler id if VM_UFFD */
+	struct vm_area *next;
+};
+
+struct vm_fault_stats {
+	u32 faults;			/* Page faults resolved by vm_fault() */
+	u32 around_windows;	/* Faults that mapped at least one neighbour */
+	u32 around_pages;	/* Neighbours mapped by fault-around */
+	u32 around_hits;	/* Of those, neighbours seen accessed afterwards */
+};
+
+/**
+ * Add an area of @len bytes at @start to the current task. If @file is 0 the
+ * area is anonymous, otherwise it maps @file from @offset.
+ */
+int vm_map(u32 start, u32 len, const vfs_node_t *file, u32 offset);
+
+/**
+ * Remove [@start, @start + @len) from the areas of the current task and
+ * release its pages. Areas crossing the range bounds are split, holes in the
+ * range are ignored.
+ */
+int vm_unmap(u32 start, u32 len);
+
+struct vm_area *vm_find_area(u32 addr);
+struct vm_area *vm_copy_areas(const struct vm_area *areas);
+
+/**
+ * Release the area descriptors of a list, not their pages.
+ */
+void vm_free_areas(struct vm_area *areas);
+
+/**
+ * Resolve a page fault at @addr with the error code @err pushed by the CPU,
+ * from user mode or from a kernel access to user memory. Return 0 if the
+ * faulting access can be retried, VM_FAULT_BLOCK if it can only be retried
+ * once user space resolved it, -1 otherwise.
+ */
+int vm_fault(u32 addr, u32 err);
+
+/**
+ * Populate the pages of [@start, @start + @len) that the kernel is about to
+ * read, or write if @write, so that it won't fault on them. Return -1 if
+ * part of the range isn't mapped, or can only be populated by a user fault
+ * handler, or if it isn't below the kernel.
+ */
+int vm_prefault(u32 start, u32 len, int write);
+
+/**
+ * Number of pages (a power of two) that each fault tries to map around the
+ * faulting one. 1 disables fault-around.
+ */
+void vm_set_fault_around(u32 pages);
+
+/**
+ * Apply @advice to the pages of [@start, @start + @len), which must be
+ * covered by areas of the current task:
+ *   - MADV_WILLNEED populates every page now,
+ *   - MADV_DONTNEED releases the frames, pages will be populated again on
+ *     next access,
+ *   - MADV_SEQUENTIAL makes faults read ahead, MADV_RANDOM disables
+ *     fault-around and MADV_NORMAL restores the default.
+ */
+int vm_madvise(u32 start, u32 len, u32 advice);
+
+/**
+ * Hand the faults on [@start, @start + @len) over to the user fault handler
+ * @uffd. See alien/memory/uffd.h.
+ */
+int vm_set_uffd(u32 start, u32 len, int uffd);
+
+void vm_get_fault_stats(struct vm_fault_stats *stats);
+void vm_dump_fault_stats();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <types.h>
+
+/**
+ * Should be called after kmalloc_init().
+ */
+void vmalloc_init();
+
+/**
+ * Allocate @size bytes of virtually contiguous kernel memory in
+ * [VMALLOC_START, VMALLOC_END), backed by frames that need not be
+ * contiguous. Allocations are page aligned and separated by an unmapped
+ * guard page. Return 0 on error.
+ */
+void *vmalloc(u32 size);
+
+/**
+ * Unmap and release an allocation returned by vmalloc().
+ */
+void vfree(void *addr);
+
+/**
+ * Map @size bytes of device memory at physical address @phys, uncached, in
+ * the vmalloc range. Return the virtual address matching @phys, or 0.
+ */
+void *ioremap(u32 phys, u32 size);
+void iounmap(void *addr);
+
+#endif
@@ -1,7 +0,0 @@
-#ifndef MM_H
-#define MM_H
-
-void init_kheap();
-void* kmalloc(u32 size);
-
-#endif
@@ -0,0 +1,61 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <alien/task.h>
+
+/*
+ * Kernel code runs with interrupts disabled unless it enables them. Where it
+ * does, as in kernel threads and at cond_resched(), the task is preempted
+ * when an interrupt returns and this CPU needs to reschedule, unless its
+ * preempt count is raised. Code with interrupts disabled is never preempted.
+ */
+
+static inline void
+set_need_resched()
+{
+	this_cpu()->need_resched = 1;
+}
+
+static inline int
+need_resched()
+{
+	return this_cpu()->need_resched;
+}
+
+/**
+ * Schedule if this CPU needs it and the current task can be preempted.
+ */
+void preempt_schedule();
+
+static inline void
+preempt_disable()
+{
+	task_header_t *task = current_task;
+	
+	if (task) {
+		task->preempt_count++;
+	}
+	
+	asm volatile ("" ::: "memory");
+}
+
+static inline void
+preempt_enable()
+{
+	task_header_t *task = current_task;
+	
+	asm volatile ("" ::: "memory");
+	
+	if (task && --task->preempt_count == 0 && need_resched()) {
+		preempt_schedule();
+	}
+}
+
+/**
+ * Preemption point for long kernel paths running with interrupts disabled:
+ * take the pending interrupts, and let another task run if one should.
+ * The task may resume on another CPU, and with its own page directory.
+ */
+void cond_resched();
+
+#endif
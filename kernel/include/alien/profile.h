@@ -0,0 +1,54 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <types.h>
+#include <alien/kernel.h>
+
+/*
+ * Sampling profiler. While it runs, the timer interrupt of each CPU comes at
+ * least at the sampling rate, and records where the CPU was: the interrupted
+ * EIP, the task, and the return addresses found by following the saved
+ * frame pointers. Samples go to a ring per CPU, dropped when it's full.
+ *
+ * profile_dump() writes one line per sample to the serial port:
+ *
+ *     prof	<cpu>	pid<pid>;<kernel|user>;<outermost>;...;<eip> 1
+ *
+ * Kernel addresses are replaced by their function name. The last field is
+ * in the folded format of flame graph tools:
+ *
+ *     grep '^prof' serial.log | cut -f3 | sort | flamegraph.pl > prof.svg
+ */
+
+/* SYS_PROFILE commands */
+#define PROFILE_START		0	/* Argument: samples per second, or 0 */
+#define PROFILE_STOP		1
+#define PROFILE_DUMP		2	/* Write and drop the samples taken so far */
+
+#define PROFILE_HZ_DEFAULT	1000
+#define PROFILE_HZ_MAX		10000
+
+#define PROFILE_DEPTH		8	/* Return addresses per sample */
+#define PROFILE_RING_SIZE	1024
+
+/**
+ * Start sampling @hz times per second on each CPU. Return -1 if @hz is
+ * too high or the rings can't be allocated.
+ */
+int profile_start(u32 hz);
+void profile_stop();
+void profile_dump();
+
+/**
+ * Record a sample of the code interrupted by the timer @frame, if this CPU
+ * is due one.
+ */
+void profile_sample(const interrupt_frame_t *frame);
+
+/**
+ * Return the TSC of the next sample of this CPU, or 0 if the profiler isn't
+ * running.
+ */
+u64 profile_next_sample();
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <types.h>
+#include <alien/timer.h>
+
+/*
+ * Runnable tasks wait in one FIFO per priority level, 0 being the highest.
+ * A bitmap of the non-empty levels gives the next task in constant time.
+ * Tasks that use up their time slice go to a second, expired set of queues
+ * which becomes the active one once every active task has run, so lower
+ * priorities still get the CPU.
+ *
+ * Each CPU has its own queues. Tasks are queued on the CPU they last ran on,
+ * and CPUs with nothing to run steal from the busiest one.
+ *
+ * Deadline tasks come before all of these. Each one reserves a runtime in
+ * every period and is run earliest deadline first; a task that uses up its
+ * runtime is throttled until its next period. They are admitted to the CPU
+ * with the least reserved bandwidth that can take them and never migrate,
+ * so the deadlines of admitted tasks are met.
+ */
+
+#define SCHED_PRIO_LEVELS	32
+#define SCHED_PRIO_DEFAULT	16
+
+/* Tasks that block get up to SCHED_BONUS_MAX / 2 levels of boost, CPU
+ * hogs lose as much */
+#define SCHED_BONUS_MAX		10
+
+/* Time slices in timer ticks, longer for higher priorities */
+#define SCHED_SLICE_MIN		2
+
+/* Expired tasks run after this many ticks at most */
+#define SCHED_STARVATION_LIMIT	100
+
+/* Bandwidth is runtime / deadline in fixed point */
+#define SCHED_DL_BW_SHIFT	20
+#define SCHED_DL_BW_ONE		(1 << SCHED_DL_BW_SHIFT)
+
+/* Share of each CPU deadline tasks may reserve, the rest is left to the
+ * other tasks */
+#define SCHED_DL_BW_LIMIT	(SCHED_DL_BW_ONE / 20 * 19)
+
+/* Longest period, in microseconds */
+#define SCHED_DL_PERIOD_MAX	10000000
+
+/* Passed to SYS_SCHED_DEADLINE, in microseconds */
+struct sched_dl_attr {
+	u32 runtime;		/* 0 to go back to the priority queues */
+	u32 deadline;		/* Relative to the start of the period */
+	u32 period;
+};
+
+/* Returned by SYS_DL_STATS */
+struct sched_dl_stats {
+	u32 misses;			/* Periods in which the task ran past its deadline */
+	u32 throttles;		/* Periods in which the task used up its runtime */
+};
+
+/* Deadline scheduling state of a task, times in TSC cycles */
+struct sched_dl {
+	u32          bw;			/* 0 unless the task is a deadline task */
+	u64          runtime;
+	u64          deadline;
+	u64          period;
+	u64          budget;		/* Runtime left in the current period */
+	u64          abs_deadline;
+	u64          stamp;			/* Last time the budget was charged */
+	u8           queued;
+	u8           throttled;
+	u8           missed;		/* The current deadline was counted as missed */
+	u32          misses;
+	u32          throttles;
+	struct timer timer;			/* Ends the throttling */
+};
+
+struct task_header;
+
+/**
+ * Set up the scheduling fields of a task which isn't queued yet.
+ */
+void sched_task_init(struct task_header *task, u8 static_prio);
+
+/**
+ * Share the remaining time slice of @parent with its new child @child, and
+ * queue @child.
+ */
+void sched_fork(struct task_header *parent, struct task_header *child);
+
+/**
+ * Queue a task that became runnable.
+ */
+void sched_enqueue(struct task_header *task);
+
+/**
+ * Queue the task that was running, in the expired queues if its time slice
+ * is over.
+ */
+void sched_requeue(struct task_header *task);
+
+/**
+ * Boost the priority of the running task, which is about to block.
+ */
+void sched_block(struct task_header *task);
+
+/**
+ * Remove and return the highest priority runnable task, or 0 if there's none.
+ */
+struct task_header *sched_pick_next();
+
+/**
+ * Return 1 if a task is queued on this CPU.
+ */
+int sched_runnable();
+
+/**
+ * Move a task queued on the busiest other CPU to this one. Return 0 if every
+ * other queue is empty.
+ */
+int sched_balance();
+
+/**
+ * Reschedule IPI: another CPU queued a task for this one or wants it to
+ * steal one.
+ */
+void sched_resched_ipi();
+
+/**
+ * Account @elapsed timer ticks to the running @task. Return 1 if it should
+ * be preempted.
+ */
+int sched_tick(struct task_header *task, u32 elapsed);
+
+/**
+ * Return 0, or -1 if @prio isn't a valid priority level.
+ */
+int sched_set_priority(struct task_header *task, u32 prio);
+
+/**
+ * Make the current task a deadline task with the parameters of @attr, or a
+ * normal one if @attr->runtime is 0. Return -1 if they're invalid or no CPU
+ * has enough bandwidth left for them.
+ */
+int sched_set_deadline(const struct sched_dl_attr *attr);
+
+void sched_dl_stats(struct task_header *task, struct sched_dl_stats *stats);
+
+/**
+ * Release the bandwidth reserved by an exiting task.
+ */
+void sched_exit(struct task_header *task);
+
+#endif
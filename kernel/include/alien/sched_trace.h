@@ -0,0 +1,63 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include <types.h>
+
+/*
+ * Scheduler trace points. Each event is written with its TSC to a ring of
+ * the last SCHED_TRACE_SIZE events, read with SYS_SCHED_TRACE. Each task
+ * also keeps histograms of how long it waited to run after a wakeup and of
+ * how long it ran once switched in, read with SYS_SCHED_HIST.
+ */
+
+#define SCHED_TRACE_SIZE	2048
+
+#define SCHED_EV_SWITCH		0	/* pid switched out for other */
+#define SCHED_EV_WAKEUP		1	/* pid woken by other */
+#define SCHED_EV_BLOCK		2
+#define SCHED_EV_FORK		3	/* pid created other */
+#define SCHED_EV_LOST		4	/* other events were overwritten unread */
+
+struct sched_event {
+	u64 tsc;
+	u8  type;
+	u8  cpu;
+	u8  state;					/* Of pid after a switch, see task.h */
+	u8  reserved;
+	u32 pid;
+	u32 other;
+} __attribute__((packed));
+
+/* Bucket i counts durations of [2^i, 2^(i+1)) microseconds, the first one
+ * also counts 0 and the last one everything longer */
+#define SCHED_HIST_BUCKETS	20
+
+/* Returned by SYS_SCHED_HIST */
+struct sched_hist {
+	u32 wakeup_latency[SCHED_HIST_BUCKETS];
+	u32 run_slice[SCHED_HIST_BUCKETS];
+	u32 wakeup_latency_max;		/* In microseconds */
+	u32 run_slice_max;
+};
+
+struct task_header;
+
+void trace_sched_switch(struct task_header *prev, struct task_header *next);
+void trace_sched_wakeup(struct task_header *task);
+void trace_sched_block(struct task_header *task);
+
+/**
+ * Record the fork of @child, and clear the statistics it copied from
+ * @parent.
+ */
+void trace_sched_fork(struct task_header *parent, struct task_header *child);
+
+/**
+ * Move up to @count of the oldest events to @events, return how many. An
+ * SCHED_EV_LOST event comes first if events were overwritten since the last
+ * read. @events is filled with interrupts disabled, so it must be kernel
+ * memory that can't fault.
+ */
+u32 sched_trace_read(struct sched_event *events, u32 count);
+
+#endif
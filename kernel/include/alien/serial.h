@@ -0,0 +1,19 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+/**
+ * Set up the first serial port (COM1) at 115200 bauds, 8N1.
+ */
+void serial_init();
+
+void serial_putc(char c);
+void serial_puts(const char *s);
+
+/**
+ * Formatted output to COM1, the formatted string must fit in
+ * SERIAL_PRINTF_MAX characters.
+ */
+#define SERIAL_PRINTF_MAX	256
+int serial_printf(const char *format, ...);
+
+#endif
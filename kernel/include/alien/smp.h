@@ -0,0 +1,89 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <types.h>
+
+#define MAX_CPUS			8
+
+/* Selector of the per-CPU data segment, loaded in GS in kernel mode */
+#define CPU_SEL				0x30
+
+struct task_header;
+
+/*
+ * Per-CPU data. Each CPU has its own GDT whose CPU_SEL segment starts at its
+ * struct cpu, so this_cpu() is a single load.
+ */
+struct cpu {
+	struct cpu         *self;
+	u32                 id;             /* Index in cpus[] */
+	u8                  apic_id;
+	volatile u8         online;
+	struct task_header *task;           /* Running task, or 0 */
+	struct task_header *idle;
+	struct task_header *dead_task;      /* Freed once off its kernel stack */
+	struct task_header *fpu_owner;      /* Task whose FPU state is loaded */
+	u32                 kernel_fpu_flags;
+	u64                 acct_stamp;     /* TSC of the last CPU time charge */
+	u32                 tick_jiffies;   /* Jiffies of the last sched_tick() */
+	volatile u8         need_resched;   /* Preempt the running task */
+	u32                 softirq_pending;
+	u8                  in_softirq;
+	u8                  irq_vector;     /* Running top half, see softirq.h */
+	u32                 tlb_gen;        /* kernel_tlb_gen last flushed */
+	u32                 kstack;         /* Boot stack of an AP */
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern u32 cpu_count;
+
+/* Bumped when a kernel page is unmapped, see lock_kernel() */
+extern volatile u32 kernel_tlb_gen;
+
+static inline struct cpu *
+this_cpu()
+{
+	struct cpu *cpu;
+	asm volatile ("mov %%gs:0, %0" : "=r" (cpu));
+	return cpu;
+}
+
+static inline struct cpu *
+boot_cpu()
+{
+	return &cpus[0];
+}
+
+/**
+ * Start the application processors listed in the ACPI MADT, one at a time.
+ * They wait in cpu_halt() until tasking_init() gives them an idle task.
+ * The caller must hold the kernel lock.
+ */
+void smp_init();
+
+/**
+ * Make @cpu reschedule, or reprogram its timer, with an IPI.
+ */
+void smp_send_resched(struct cpu *cpu);
+
+/*
+ * The kernel lock is held by the CPU running kernel code, so that the rest
+ * of the kernel, written for a single CPU, only runs on one at a time. User
+ * code runs in parallel. interrupt_handler() takes it on entry unless this
+ * CPU holds it already, and the idle loop drops it while halting.
+ */
+void lock_kernel();
+void unlock_kernel();
+
+/**
+ * Return 1 if this CPU holds the kernel lock.
+ */
+int kernel_locked();
+
+/**
+ * Halt until the next interrupt, without holding the kernel lock. Must be
+ * called with interrupts disabled, which they are again on return.
+ */
+void cpu_halt();
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <types.h>
+
+/*
+ * Interrupt handlers come in two halves. The top half runs with interrupts
+ * disabled and only does what can't wait: acknowledge the device, then
+ * raise a softirq or schedule a tasklet for the rest. The bottom halves run
+ * on the way out of the interrupt with interrupts enabled, so the other
+ * devices' interrupts don't wait for them.
+ */
+
+#define SOFTIRQ_TIMER		0	/* Timer wheel */
+#define SOFTIRQ_TASKLET		1
+#define SOFTIRQ_COUNT		2
+
+/* Rounds of bottom halves on one interrupt exit, the work raised after that
+ * waits for the next exit */
+#define SOFTIRQ_MAX_RESTART	8
+
+typedef void (*softirq_fn_t) ();
+
+struct tasklet;
+typedef void (*tasklet_fn_t) (struct tasklet *tasklet);
+
+/* Deferred call queued on a per-CPU list */
+struct tasklet {
+	struct tasklet *next;
+	tasklet_fn_t    fn;
+	void           *data;
+	volatile u32    queued;
+	u8              vector;			/* Interrupt that queued it, or 0 */
+};
+
+/* Returned by SYS_IRQ_STATS, for one interrupt vector */
+struct irq_stats {
+	u32 count;
+	u64 cycles;						/* In the top half, TSC */
+	u32 max_cycles;
+	u32 deferred;					/* Bottom halves queued by the top half */
+	u32 done;						/* ...and run */
+	u32 max_backlog;				/* Most bottom halves waiting at once */
+};
+
+void open_softirq(u32 nr, softirq_fn_t fn);
+
+/**
+ * Run the handler of softirq @nr on this CPU, the next time an interrupt
+ * returns to code running with interrupts enabled. Call with interrupts
+ * disabled.
+ */
+void raise_softirq(u32 nr);
+
+/**
+ * Run the pending softirqs with interrupts enabled, unless this CPU is
+ * running them already. The current task is not preempted meanwhile.
+ */
+void do_softirq();
+
+int softirq_pending();
+
+void tasklet_init(struct tasklet *tasklet, tasklet_fn_t fn, void *data);
+
+/**
+ * Queue @tasklet on this CPU unless it's queued already, return 1 if it
+ * was. It runs once from the softirq, and can be queued again from then on.
+ */
+int tasklet_schedule(struct tasklet *tasklet);
+
+/**
+ * Account a top half of @vector that took @cycles.
+ */
+void irq_account(u32 vector, u32 cycles);
+
+/**
+ * Return 0, or -1 if @vector isn't an interrupt vector.
+ */
+int irq_get_stats(u32 vector, struct irq_stats *stats);
+
+/**
+ * Print the statistics of the vectors that were used.
+ */
+void irq_stats_dump();
+
+#endif
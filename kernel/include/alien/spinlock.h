@@ -0,0 +1,42 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <types.h>
+
+typedef struct spinlock {
+	volatile u32 locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT		{ 0 }
+
+static inline void
+spin_lock_init(spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+static inline int
+spin_trylock(spinlock_t *lock)
+{
+	return !__sync_lock_test_and_set(&lock->locked, 1);
+}
+
+/* Spin on a plain read until the lock looks free, so that waiting CPUs
+ * don't keep bouncing its cache line */
+static inline void
+spin_lock(spinlock_t *lock)
+{
+	while (!spin_trylock(lock)) {
+		while (lock->locked) {
+			asm volatile ("pause");
+		}
+	}
+}
+
+static inline void
+spin_unlock(spinlock_t *lock)
+{
+	__sync_lock_release(&lock->locked);
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+/*
+ * System calls are made with `int 0x64`. The call number is passed in EAX,
+ * the arguments in EBX, ECX and EDX, and the return value comes back in EAX.
+ */
+#define SYSCALL_VECTOR		100
+
+#define SYS_PRINT			0x00
+#define SYS_FORK			0x01
+#define SYS_SHM_OPEN		0x02	/* (name, size) -> id */
+#define SYS_SHM_ATTACH		0x03	/* (id, vaddr) */
+#define SYS_SHM_DETACH		0x04	/* (id, vaddr) */
+#define SYS_SHM_UNLINK		0x05	/* (name) */
+#define SYS_EXIT			0x06
+#define SYS_MMAP			0x07	/* (addr, len, path or 0 for anonymous) */
+#define SYS_MUNMAP			0x08	/* (addr, len) */
+#define SYS_MADVISE			0x09	/* (addr, len, advice) */
+#define SYS_UFFD_CREATE		0x0A	/* () -> id */
+#define SYS_UFFD_REGISTER	0x0B	/* (id, addr, len) */
+#define SYS_UFFD_READ		0x0C	/* (id, struct uffd_event *) */
+#define SYS_UFFD_COPY		0x0D	/* (id, dst, src) */
+#define SYS_SETPRIO			0x0E	/* (priority), 0 is the highest */
+#define SYS_NANOSLEEP		0x0F	/* (seconds, nanoseconds) */
+#define SYS_TIMES			0x10	/* (struct task_times *) */
+#define SYS_SCHED_DEADLINE	0x11	/* (struct sched_dl_attr *) */
+#define SYS_DL_STATS		0x12	/* (struct sched_dl_stats *) */
+#define SYS_IRQ_STATS		0x13	/* (vector, struct irq_stats *) */
+#define SYS_PROFILE			0x14	/* (command, argument), see profile.h */
+#define SYS_SCHED_TRACE		0x15	/* (struct sched_event *, count) -> count */
+#define SYS_SCHED_HIST		0x16	/* (own or child pid or 0, struct sched_hist *) */
+
+#endif
@@ -3,24 +3,132 @@
 
 #include <types.h>
 #include <alien/kernel.h>
+#include <alien/memory/arena.h>
+#include <alien/smp.h>
+#include <alien/sched.h>
+#include <alien/sched_trace.h>
 
 typedef struct task_info {
     u32         pid;
     u32         cr3;
-    struct regs regs;
-    u32         eflags;
-    u32         eip;
+    u32         eip;            /* User mode entry point of the first task */
     u32         cs, ss, esp;
 } task_info_t;
 
+#define TASK_RUNNING    0
+#define TASK_BLOCKED    1
+#define TASK_DEAD       2
+
+/* task_header_t flags */
+#define TASK_KTHREAD    0x1     /* Runs in ring 0 on the kernel page directory */
+#define TASK_IDLE       0x2     /* Runs when no other task is runnable */
+
+#define KERNEL_STACK_SIZE   0x2000
+
+typedef void (*kthread_fn_t) (void *arg);
+
+struct vm_area;
+struct prio_array;
+struct fpu_state;
+
 typedef struct task_header {
     struct task_info    info;
-    struct task_header *next;
+    struct task_header *next;       /* Ring of all the tasks */
+    struct task_header *parent;     /* Forking task, 0 once it exited */
+    struct vm_area     *vm_areas;
+    u8                  state;
+    u8                  flags;
+    struct arena        scratch;    /* Emptied on each syscall entry */
+    u32                 kstack;     /* Base of the kernel stack */
+    u32                 kesp;       /* Kernel stack pointer while switched out */
+    struct fpu_state   *fpu;        /* Allocated on first use, see fpu.h */
+    struct cpu         *fpu_cpu;    /* Last CPU whose FPU registers it used */
+
+    /* Scheduling, see sched.h */
+    u8                  static_prio;
+    u8                  prio;       /* static_prio adjusted by bonus */
+    u8                  bonus;
+    u8                  timeslice;  /* Ticks left */
+    struct prio_array  *array;      /* Run queues holding the task, or 0 */
+    u8                  cpu;        /* Queued on, or last ran on */
+    struct task_header *rq_next, *rq_prev;
+    struct task_header *wait_next;  /* Next task on the same wait queue */
+    u32                 preempt_count;  /* Not preempted unless 0, see preempt.h */
+    struct sched_dl     dl;
+
+    /* CPU time in TSC cycles, the system time of the idle task is the
+     * time the CPU was idle */
+    u64                 utime;
+    u64                 stime;
+
+    /* Scheduler statistics, see sched_trace.h */
+    u64                 wake_stamp;     /* TSC of the last wakeup, 0 once running */
+    u64                 run_stamp;      /* TSC of the last switch in */
+    struct sched_hist   hist;
 } task_header_t;
 
+/* Returned by SYS_TIMES, in microseconds */
+struct task_times {
+    u64 utime;
+    u64 stime;
+    u64 idle;                       /* Since boot, summed over the CPUs */
+};
+
+#define current_task    (this_cpu()->task)
+
 void tasking_init(u32 cr3, u32 eip, u32 esp, u32 ss, u32 cs);
 void usermode();
-void fork();
-void sched(interrupt_frame_t frame);
+
+/**
+ * Duplicate the current task, which made a syscall from user mode. The new
+ * task returns from the syscall with 0 in EAX when it's first scheduled.
+ * Return 1 to the parent, or -1 on error.
+ */
+i32 fork(const interrupt_frame_t *frame);
+
+/**
+ * Create a runnable kernel thread calling @fn(@arg), with interrupts
+ * enabled. The thread exits when @fn returns. Tasking must be initialized.
+ * Return 0 if there's not enough memory.
+ */
+task_header_t *kthread_create(kthread_fn_t fn, void *arg);
+
+/**
+ * Switch to the next runnable task. The current task resumes by returning
+ * from this function, on its own kernel stack.
+ */
+void schedule();
+
+/**
+ * Run the idle task of this AP, once tasking_init() created it. Never
+ * returns.
+ */
+void task_enter_idle();
+
+/**
+ * Charge the CPU time since the last call to the current task, as user time
+ * if @user.
+ */
+void task_account(int user);
+
+void task_times(struct task_times *times);
+
+/**
+ * Return the current task if its pid is @pid, else the first of its
+ * children with that pid, or 0.
+ */
+task_header_t *task_find_own(u32 pid);
+
+/**
+ * Remove the current task from the task list, release its address space and
+ * switch to the next task. Never returns.
+ */
+void task_exit();
+
+/**
+ * Switch to another task until task_wake() is called on the current one.
+ */
+void task_block();
+void task_wake(task_header_t *task);
 
 #endif
@@ -0,0 +1,102 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <types.h>
+
+/* Timer interrupt frequency, see make.conf */
+#ifndef HZ
+#define HZ					100
+#endif
+
+#define PIT_FREQUENCY		1193182
+
+/* Ticks since time_init(), wraps around: compare with time_after() */
+extern volatile u32 jiffies;
+
+/* TSC frequency, measured by time_init() */
+extern u32 tsc_khz;
+
+#define time_after(a, b)		((i32) ((b) - (a)) < 0)
+#define time_after_eq(a, b)		((i32) ((a) - (b)) >= 0)
+#define time_before(a, b)		time_after(b, a)
+
+#define msecs_to_jiffies(ms)	(((ms) * HZ + 999) / 1000)
+#define jiffies_to_msecs(j)		((j) * 1000 / HZ)
+
+struct timer_link {
+	struct timer_link *next, *prev;
+};
+
+struct timer;
+typedef void (*timer_fn_t) (struct timer *timer);
+
+/*
+ * Timers live in the buckets of a hierarchical wheel: adding or cancelling
+ * one is constant time, and each tick only looks at the timers due in it
+ * (plus moving the timers of a higher level bucket down every 256 ticks).
+ */
+struct timer {
+	struct timer_link link;		/* Not linked unless pending */
+	u32               expires;	/* In jiffies */
+	timer_fn_t        fn;
+	void             *data;
+};
+
+/**
+ * Start counting jiffies. With a local APIC its timer is programmed for the
+ * next timer or end of time slice only, so an idle CPU doesn't take a tick;
+ * otherwise the PIT ticks at HZ.
+ */
+void time_init();
+
+/**
+ * Reprogram the one-shot timer for the current task, after a task switch.
+ * Does nothing when the PIT ticks periodically.
+ */
+void clock_program();
+
+/**
+ * Timer interrupt: update jiffies and tick the scheduler. The timers due run
+ * in a softirq, with interrupts enabled, which then programs the next
+ * interrupt.
+ */
+void timer_interrupt();
+
+u64 tsc_to_us(u64 cycles);
+u64 us_to_tsc(u32 us);
+
+/**
+ * Return the number of jiffies in @cycles, rounded up.
+ */
+u32 tsc_to_jiffies(u64 cycles);
+
+/**
+ * Busy wait @ms milliseconds on PIT channel 2, at most 50.
+ */
+void pit_delay_ms(u32 ms);
+
+void timer_init(struct timer *timer, timer_fn_t fn, void *data);
+
+/**
+ * Call @timer->fn at jiffies @expires, from the timer softirq. A pending
+ * timer is moved to the new date.
+ */
+void timer_add(struct timer *timer, u32 expires);
+
+/**
+ * Return 1 if @timer was pending.
+ */
+int timer_cancel(struct timer *timer);
+
+static inline int
+timer_pending(const struct timer *timer)
+{
+	return timer->link.next != 0;
+}
+
+/**
+ * Put the current task to sleep for at least @ticks jiffies.
+ */
+void sleep_ticks(u32 ticks);
+
+#endif
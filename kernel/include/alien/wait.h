@@ -0,0 +1,74 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <types.h>
+#include <alien/kernel.h>
+
+struct task_header;
+
+/*
+ * Tasks sleeping until an event, woken in FIFO order. Wake ups may come
+ * from IRQ handlers.
+ */
+typedef struct wait_queue {
+	struct task_header *head, *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT		{ 0, 0 }
+
+void wait_queue_init(wait_queue_t *wq);
+
+/**
+ * Put the current task to sleep on @wq until it's woken up. Must be called
+ * with interrupts disabled, after checking the condition waited for. Before
+ * tasking is set up, this only halts until the next interrupt.
+ */
+void wait_on(wait_queue_t *wq);
+
+/**
+ * Wake up the oldest task sleeping on @wq, return 0 if there was none.
+ */
+int wake_up(wait_queue_t *wq);
+void wake_up_all(wait_queue_t *wq);
+
+/**
+ * Sleep on @wq until @cond is true.
+ */
+#define wait_event(wq, cond) \
+	do { \
+		u32 __flags = irq_save(); \
+		while (!(cond)) \
+			wait_on(wq); \
+		irq_restore(__flags); \
+	} while (0)
+
+/*
+ * One-shot event, typically signaled by an IRQ handler for a request a task
+ * is waiting on.
+ */
+struct completion {
+	u32          done;
+	wait_queue_t wait;
+};
+
+void init_completion(struct completion *c);
+
+/**
+ * Forget past complete() calls, before starting a new request.
+ */
+void reinit_completion(struct completion *c);
+
+void complete(struct completion *c);
+
+/**
+ * Sleep until complete() is called, and consume one completion.
+ */
+void wait_for_completion(struct completion *c);
+
+/**
+ * Like wait_for_completion(), but give up after @ticks jiffies. Return 1 if
+ * a completion was consumed, 0 on timeout.
+ */
+int wait_for_completion_timeout(struct completion *c, u32 ticks);
+
+#endif
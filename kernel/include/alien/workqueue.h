@@ -0,0 +1,52 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <types.h>
+
+/*
+ * Deferred work, run in order by a pool of kernel threads. Work can be
+ * queued from IRQ handlers.
+ */
+
+struct work;
+
+typedef void (*work_fn_t) (struct work *work);
+
+struct work {
+	work_fn_t    fn;
+	struct work *next;
+	u8           pending;		/* Queued and not started yet */
+};
+
+#define INIT_WORK(w, f) \
+	do { \
+		(w)->fn = (f); \
+		(w)->next = 0; \
+		(w)->pending = 0; \
+	} while (0)
+
+struct workqueue;
+
+/* Shared queue for small jobs, see schedule_work() */
+extern struct workqueue *system_wq;
+
+/**
+ * Create the system workqueue, called by tasking_init().
+ */
+void workqueue_init();
+
+/**
+ * Create a queue served by @workers kernel threads. Return 0 if there's not
+ * enough memory.
+ */
+struct workqueue *workqueue_create(u32 workers);
+
+/**
+ * Queue @work at the end of @wq, unless it's still pending. Return 1 if it
+ * was queued. @work must stay valid until it has run.
+ */
+int queue_work(struct workqueue *wq, struct work *work);
+
+int schedule_work(struct work *work);
+
+#endif
@@ -1,9 +1,17 @@
 #include <list.h>
+#include <alien/memory/slab.h>
+
+static struct kmem_cache *list_cache;
 
 static struct list_head *
 list_new_element(void *data)
 {
-    struct list_head *el = (struct list_head *) kmalloc(sizeof(struct list_head));
+    if (!list_cache) {
+        list_cache = kmem_cache_create("list_head", sizeof(struct list_head),
+                                       0, 0);
+    }
+
+    struct list_head *el = (struct list_head *) kmem_cache_alloc(list_cache);
     el->data = data;
     el->next = 0;
     return el;
@@ -170,3 +170,8 @@ int ksprintf(char *out, const char *format, ...)
     va_start( args, format );
     return print( &out, format, args );
 }
+
+int kvsprintf(char *out, const char *format, va_list args)
+{
+    return print( &out, format, args );
+}
@@ -0,0 +1,155 @@
+#ifdef ALLOC_PROFILE
+
+#include <alien/memory/alloc_profile.h>
+#include <alien/ksyms.h>
+#include <alien/serial.h>
+
+/* Open addressing hash table, the slot 0 is never used */
+#define PROFILE_SITES		512
+
+struct alloc_site {
+	u32 caller;
+	u8  kind;
+	u32 count;
+	u32 live;
+	u32 live_bytes;
+	u64 bytes;
+	u64 cycles;
+};
+
+static struct alloc_site sites[PROFILE_SITES];
+static u32 dropped = 0;
+
+static const char *kind_names[] = { "kmalloc", "frame" };
+
+u16
+profile_alloc(u8 kind, u32 caller, u32 bytes, u64 cycles)
+{
+	u32 i = ((caller ^ kind) * 2654435761U) % (PROFILE_SITES - 1) + 1;
+	
+	for (u32 n = 0; n < PROFILE_SITES - 1; n++) {
+		struct alloc_site *s = &sites[i];
+		
+		if (s->caller == 0) {
+			s->caller = caller;
+			s->kind = kind;
+		}
+		
+		if (s->caller == caller && s->kind == kind) {
+			s->count++;
+			s->live++;
+			s->live_bytes += bytes;
+			s->bytes += bytes;
+			s->cycles += cycles;
+			return i;
+		}
+		
+		i = i % (PROFILE_SITES - 1) + 1;
+	}
+	
+	dropped++;
+	
+	return 0;
+}
+
+void
+profile_free(u16 site, u32 bytes)
+{
+	if (site == 0 || site >= PROFILE_SITES || sites[site].live == 0) {
+		return;
+	}
+	
+	sites[site].live--;
+	sites[site].live_bytes -= bytes;
+}
+
+void
+alloc_profile_reset()
+{
+	/* Live counts are kept so that the sites of outstanding allocations
+	 * stay valid */
+	for (u32 i = 1; i < PROFILE_SITES; i++) {
+		sites[i].count = 0;
+		sites[i].bytes = 0;
+		sites[i].cycles = 0;
+	}
+	
+	dropped = 0;
+}
+
+/* Divide @n in place by @d <= 0xFFFF with 32 bits operations, return the rest */
+static u32
+div_small(u64 *n, u32 d)
+{
+	u32 rest = 0;
+	u64 q = 0;
+	
+	for (int shift = 48; shift >= 0; shift -= 16) {
+		u32 cur = (rest << 16) | ((*n >> shift) & 0xFFFF);
+		q |= (u64) (cur / d) << shift;
+		rest = cur % d;
+	}
+	
+	*n = q;
+	
+	return rest;
+}
+
+static char *
+u64_str(u64 n, char *buffer)
+{
+	char *s = buffer + 20;
+	
+	*s = '\0';
+	do {
+		*--s = '0' + div_small(&n, 10);
+	} while (n);
+	
+	return s;
+}
+
+void
+alloc_profile_dump()
+{
+	char bytes[21], cycles[21], avg[21];
+	
+	serial_puts("# kind\tcaller\tcount\tbytes\tlive\tlive_bytes\tcycles\t"
+				"cycles_per_alloc\tsymbol\n");
+	
+	for (u32 i = 1; i < PROFILE_SITES; i++) {
+		struct alloc_site *s = &sites[i];
+		u32 offset = 0;
+		
+		if (s->caller == 0 || (s->count == 0 && s->live == 0))
+			continue;
+		
+		/* div_small() takes 16 bits divisors, scale both sides down */
+		u64 per_alloc = s->cycles;
+		u32 count = s->count;
+		while (count > 0xFFFF) {
+			per_alloc >>= 1;
+			count >>= 1;
+		}
+		if (count)
+			div_small(&per_alloc, count);
+		
+		const char *name = ksym_lookup(s->caller, &offset);
+		
+		serial_printf("%s\t0x%08x\t%u\t%s\t%u\t%u\t%s\t%s\t", kind_names[s->kind],
+					  s->caller, s->count, u64_str(s->bytes, bytes), s->live,
+					  s->live_bytes, u64_str(s->cycles, cycles),
+					  u64_str(per_alloc, avg));
+		
+		if (name) {
+			serial_puts(name);
+			serial_printf("+0x%x\n", offset);
+		} else {
+			serial_puts("?\n");
+		}
+	}
+	
+	if (dropped)
+		serial_printf("# %u allocations from untracked sites\n", dropped);
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include <alien/memory/arena.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/vmalloc.h>
+#include <alien/kernel.h>
+
+#define ARENA_ALIGN		8
+
+struct arena_chunk {
+	struct arena_chunk *prev;
+	u32                 size;		/* Mapped bytes, header included */
+};
+
+#define CHUNK_DATA(c)	((u32) (c) + sizeof(struct arena_chunk))
+#define CHUNK_END(c)	((u32) (c) + (c)->size)
+
+void
+arena_init(struct arena *arena)
+{
+	arena->chunk = 0;
+	arena->pos = 0;
+	arena->end = 0;
+}
+
+static struct arena_chunk *
+chunk_alloc(u32 size)
+{
+	struct arena_chunk *chunk;
+	
+	size += sizeof(struct arena_chunk);
+	
+	if (size <= PAGE_SIZE) {
+		size = PAGE_SIZE;
+		chunk = (struct arena_chunk *) alloc_kpage();
+	} else {
+		size = updiv(size, PAGE_SIZE) * PAGE_SIZE;
+		chunk = (struct arena_chunk *) vmalloc(size);
+	}
+	
+	if (chunk)
+		chunk->size = size;
+	
+	return chunk;
+}
+
+static void
+chunk_free(struct arena_chunk *chunk)
+{
+	if (chunk->size == PAGE_SIZE)
+		free_page((u32) chunk);
+	else
+		vfree(chunk);
+}
+
+static void
+set_chunk(struct arena *arena, struct arena_chunk *chunk, u32 pos)
+{
+	arena->chunk = chunk;
+	arena->pos = pos;
+	arena->end = chunk ? CHUNK_END(chunk) : 0;
+}
+
+void *
+arena_alloc(struct arena *arena, u32 size)
+{
+	u32 pos = (arena->pos + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	
+	if (!arena->chunk || size > arena->end - pos || pos > arena->end) {
+		struct arena_chunk *chunk = chunk_alloc(size);
+		if (!chunk)
+			return 0;
+		
+		chunk->prev = arena->chunk;
+		set_chunk(arena, chunk, CHUNK_DATA(chunk));
+		pos = arena->pos;
+	}
+	
+	arena->pos = pos + size;
+	
+	return (void *) pos;
+}
+
+struct arena_mark
+arena_save(const struct arena *arena)
+{
+	struct arena_mark mark = { arena->chunk, arena->pos };
+	
+	return mark;
+}
+
+void
+arena_restore(struct arena *arena, struct arena_mark mark)
+{
+	while (arena->chunk != mark.chunk) {
+		struct arena_chunk *prev = arena->chunk->prev;
+		
+		chunk_free(arena->chunk);
+		arena->chunk = prev;
+	}
+	
+	set_chunk(arena, mark.chunk, mark.pos);
+}
+
+void
+arena_reset(struct arena *arena)
+{
+	if (!arena->chunk)
+		return;
+	
+	struct arena_chunk *first = arena->chunk;
+	
+	while (first->prev) {
+		first = first->prev;
+	}
+	
+	arena_restore(arena, (struct arena_mark) { first, CHUNK_DATA(first) });
+}
+
+void
+arena_release(struct arena *arena)
+{
+	arena_restore(arena, (struct arena_mark) { 0, 0 });
+}
@@ -1,78 +1,793 @@
 #include <alien/memory/kmalloc.h>
 #include <alien/memory/paging.h>
+#include <alien/memory/alloc_profile.h>
+#include <alien/kernel.h>
 #include <alien/io.h>
+#include <alien/string.h>
 
-#define FLAGS_USED 1
-#define FLAGS_LAST 2
+/*
+ * Two-level segregated fit allocator (TLSF). Free blocks are kept in
+ * segregated lists indexed by a first level (power of two of the size) and
+ * a second level (SL_COUNT linear subdivisions of that power of two). Two
+ * levels of bitmaps tell which lists are non-empty, so finding a free block
+ * large enough, splitting and merging are all constant time.
+ */
+
+#define ALIGN_LOG2		3
+#define ALIGN_SIZE		(1 << ALIGN_LOG2)
+
+#define SL_LOG2			4
+#define SL_COUNT		(1 << SL_LOG2)
+#define FL_SHIFT		(SL_LOG2 + ALIGN_LOG2)
+#define FL_MAX_LOG2		26
+#define FL_COUNT		(FL_MAX_LOG2 - FL_SHIFT + 1)
+
+/* Sizes below are mapped linearly in the first level 0 */
+#define SMALL_BLOCK_SIZE	(1 << FL_SHIFT)
+
+/* The heap grows by at least this amount, and keeps at least one page */
+#define HEAP_GROW_MIN	(4 * PAGE_SIZE)
+
+#define PAGE_ALIGN(a)	(((a) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define FLAGS_FREE		1
+#define FLAGS_PREV_FREE	2
+#define FLAGS_MASK		(FLAGS_FREE | FLAGS_PREV_FREE)
 
 typedef struct kheap_block
 {
-	u32 size;
-	u8 flags;
-} __attribute__((packed)) kheap_block_t;
+	struct kheap_block *prev_phys;	/* Previous block in memory */
+	u32 size;						/* Size of the payload and flags */
+#ifdef ALLOC_PROFILE
+	u32 site;						/* Call site of a used block */
+	u32 reserved;					/* Keeps the payload ALIGN_SIZE aligned */
+#endif
+	
+	/* Only valid in free blocks, these live in the payload */
+	struct kheap_block *next_free;
+	struct kheap_block *prev_free;
+} kheap_block_t;
 
-static kheap_block_t *heap = 0;
+#define BLOCK_OVERHEAD	__builtin_offsetof(kheap_block_t, next_free)
+#define BLOCK_SIZE_MIN	(sizeof(kheap_block_t) - BLOCK_OVERHEAD)
 
-void
-kmalloc_init()
+/* The heap is [KHEAP_START, heap_end), the last block is a used sentinel */
+static u32 heap_end = KHEAP_START;
+static kheap_block_t *sentinel = 0;
+static u8 growing = 0;
+static struct kmalloc_stats stats;
+
+static u32 fl_bitmap = 0;
+static u32 sl_bitmap[FL_COUNT];
+static kheap_block_t *free_lists[FL_COUNT][SL_COUNT];
+
+static inline u32
+_size(const kheap_block_t *b)
 {
-	heap  = (kheap_block_t *) alloc_kpage();
-	heap->flags = FLAGS_LAST;
-	heap->size = 4096 - sizeof(kheap_block_t);
+	return b->size & ~FLAGS_MASK;
+}
+
+static inline u8
+_is_free(const kheap_block_t *b)
+{
+	return b->size & FLAGS_FREE;
+}
+
+static inline u8
+_is_prev_free(const kheap_block_t *b)
+{
+	return b->size & FLAGS_PREV_FREE;
 }
 
 static inline u32
 _block_base(const kheap_block_t *b)
 {
-	return (((u32)b) + sizeof(kheap_block_t));
+	return (((u32)b) + BLOCK_OVERHEAD);
+}
+
+static inline kheap_block_t *
+_from_base(const void *p)
+{
+	return (kheap_block_t *) (((u32)p) - BLOCK_OVERHEAD);
 }
 
 static inline kheap_block_t *
 _next(const kheap_block_t *b)
 {
-	return (kheap_block_t *) (((u32)b) + sizeof(kheap_block_t) + b->size);
+	return (kheap_block_t *) (_block_base(b) + _size(b));
 }
 
-static inline u8
-_is_last(const kheap_block_t *b)
+static inline int
+fls(u32 word)
 {
-	return b->flags & FLAGS_LAST;
+	return 31 - __builtin_clz(word);
 }
 
-static inline u8
-_is_used(const kheap_block_t *b)
+static inline int
+ffs(u32 word)
+{
+	return __builtin_ctz(word);
+}
+
+static void
+mapping_insert(u32 size, int *fl, int *sl)
+{
+	if (size < SMALL_BLOCK_SIZE) {
+		*fl = 0;
+		*sl = size / (SMALL_BLOCK_SIZE / SL_COUNT);
+	} else {
+		int f = fls(size);
+		*sl = (size >> (f - SL_LOG2)) ^ (1 << SL_LOG2);
+		*fl = f - (FL_SHIFT - 1);
+	}
+}
+
+/*
+ * Like mapping_insert() but rounds the size up to the next list, so that any
+ * block of that list is large enough.
+ */
+static void
+mapping_search(u32 size, int *fl, int *sl)
+{
+	if (size >= SMALL_BLOCK_SIZE) {
+		size += (1 << (fls(size) - SL_LOG2)) - 1;
+	}
+	
+	mapping_insert(size, fl, sl);
+}
+
+static kheap_block_t *
+find_suitable_block(int *fl, int *sl)
+{
+	u32 sl_map = sl_bitmap[*fl] & (~0U << *sl);
+	
+	if (!sl_map) {
+		u32 fl_map = *fl + 1 < 32 ? fl_bitmap & (~0U << (*fl + 1)) : 0;
+		
+		if (!fl_map) {
+			return (kheap_block_t *) 0;
+		}
+		
+		*fl = ffs(fl_map);
+		sl_map = sl_bitmap[*fl];
+	}
+	
+	*sl = ffs(sl_map);
+	
+	return free_lists[*fl][*sl];
+}
+
+static void
+remove_free_block(kheap_block_t *b, int fl, int sl)
+{
+	if (b->prev_free)
+		b->prev_free->next_free = b->next_free;
+	if (b->next_free)
+		b->next_free->prev_free = b->prev_free;
+	
+	if (free_lists[fl][sl] == b) {
+		free_lists[fl][sl] = b->next_free;
+		
+		if (!free_lists[fl][sl]) {
+			sl_bitmap[fl] &= ~(1 << sl);
+			if (!sl_bitmap[fl])
+				fl_bitmap &= ~(1 << fl);
+		}
+	}
+}
+
+static void
+insert_free_block(kheap_block_t *b)
+{
+	int fl, sl;
+	
+	mapping_insert(_size(b), &fl, &sl);
+	
+	b->prev_free = 0;
+	b->next_free = free_lists[fl][sl];
+	if (b->next_free)
+		b->next_free->prev_free = b;
+	
+	free_lists[fl][sl] = b;
+	fl_bitmap |= 1 << fl;
+	sl_bitmap[fl] |= 1 << sl;
+}
+
+static void
+block_remove(kheap_block_t *b)
+{
+	int fl, sl;
+	
+	mapping_insert(_size(b), &fl, &sl);
+	remove_free_block(b, fl, sl);
+}
+
+static void
+mark_free(kheap_block_t *b)
+{
+	kheap_block_t *next = _next(b);
+	
+	b->size |= FLAGS_FREE;
+	next->size |= FLAGS_PREV_FREE;
+	next->prev_phys = b;
+}
+
+static void
+mark_used(kheap_block_t *b)
+{
+	b->size &= ~FLAGS_FREE;
+	_next(b)->size &= ~FLAGS_PREV_FREE;
+}
+
+/*
+ * Split @b so that its payload is @size bytes, and give the remainder back
+ * to the free lists.
+ */
+static void
+split(kheap_block_t *b, u32 size)
+{
+	if (_size(b) < size + sizeof(kheap_block_t)) {
+		return;
+	}
+	
+	kheap_block_t *rest = (kheap_block_t *) (_block_base(b) + size);
+	
+	rest->size = _size(b) - size - BLOCK_OVERHEAD;
+	rest->prev_phys = b;
+	b->size = size | (b->size & FLAGS_MASK);
+	
+	mark_free(rest);
+	insert_free_block(rest);
+}
+
+/* Merge the free block @b with its free neighbours */
+static kheap_block_t *
+merge(kheap_block_t *b)
+{
+	if (_is_prev_free(b)) {
+		kheap_block_t *prev = b->prev_phys;
+		
+		block_remove(prev);
+		prev->size += _size(b) + BLOCK_OVERHEAD;
+		b = prev;
+	}
+	
+	kheap_block_t *next = _next(b);
+	
+	if (_is_free(next)) {
+		block_remove(next);
+		b->size += _size(next) + BLOCK_OVERHEAD;
+	}
+	
+	_next(b)->prev_phys = b;
+	
+	return b;
+}
+
+static inline u32
+adjust_size(u32 s)
+{
+	if (s < BLOCK_SIZE_MIN) {
+		s = BLOCK_SIZE_MIN;
+	}
+	
+	return (s + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+}
+
+/*
+ * Map @size more bytes of pages at the end of the heap. The old sentinel
+ * becomes the header of a free block covering them, merged with the last
+ * block if that one is free.
+ */
+static int
+heap_grow(u32 size)
+{
+	u32 new_end = heap_end + PAGE_ALIGN(size);
+	
+	if (new_end > KHEAP_END || new_end < heap_end) {
+		return -1;
+	}
+	
+	growing = 1;
+	
+	for (u32 page = heap_end; page < new_end; page += PAGE_SIZE) {
+		if (!map_at(page, alloc_frame(), PAGE_RW)) {
+			while (page > heap_end) {
+				page -= PAGE_SIZE;
+				free_page(page);
+			}
+			growing = 0;
+			return -1;
+		}
+	}
+	
+	growing = 0;
+	
+	kheap_block_t *b = sentinel;
+	
+	if (heap_end == KHEAP_START) {
+		b = (kheap_block_t *) KHEAP_START;
+		b->prev_phys = 0;
+		b->size = 0;
+	}
+	
+	b->size = (new_end - _block_base(b) - BLOCK_OVERHEAD) | (b->size & FLAGS_MASK);
+	
+	sentinel = _next(b);
+	sentinel->size = 0;
+	
+	stats.heap_size += new_end - heap_end;
+	if (stats.heap_size > stats.heap_peak)
+		stats.heap_peak = stats.heap_size;
+	stats.grows++;
+	heap_end = new_end;
+	
+	mark_free(b);
+	insert_free_block(merge(b));
+	
+	return 0;
+}
+
+void
+kmalloc_init()
+{
+	reserve_kernel_range(KHEAP_START, KHEAP_END);
+	heap_grow(PAGE_SIZE);
+}
+
+u32
+kmalloc_trim()
+{
+	if (!sentinel || growing || !_is_prev_free(sentinel)) {
+		return 0;
+	}
+	
+	kheap_block_t *b = sentinel->prev_phys;
+	u32 new_end = PAGE_ALIGN((u32) b + sizeof(kheap_block_t) + BLOCK_OVERHEAD);
+	
+	if (new_end < KHEAP_START + PAGE_SIZE) {
+		new_end = KHEAP_START + PAGE_SIZE;
+	}
+	
+	if (new_end >= heap_end) {
+		return 0;
+	}
+	
+	u32 released = heap_end - new_end;
+	
+	block_remove(b);
+	
+	for (u32 page = new_end; page < heap_end; page += PAGE_SIZE) {
+		free_page(page);
+	}
+	
+	b->size = (new_end - _block_base(b) - BLOCK_OVERHEAD) | (b->size & FLAGS_MASK);
+	sentinel = _next(b);
+	sentinel->size = 0;
+	heap_end = new_end;
+	
+	mark_free(b);
+	insert_free_block(b);
+	
+	stats.heap_size -= released;
+	stats.shrinks++;
+	
+	return released;
+}
+
+void
+kmalloc_get_stats(struct kmalloc_stats *out)
+{
+	*out = stats;
+}
+
+/*
+ * Find a free block of at least @s bytes, growing the heap if needed, and
+ * remove it from the free lists.
+ */
+static kheap_block_t *
+take_block(u32 s)
+{
+	int fl, sl;
+	
+	mapping_search(s, &fl, &sl);
+	
+	if (fl >= FL_COUNT) {
+		return 0;
+	}
+	
+	kheap_block_t *b = find_suitable_block(&fl, &sl);
+	
+	if (!b) {
+		/* Room for a block of the next size class, as mapping_search() */
+		u32 grow = s + sizeof(kheap_block_t) + BLOCK_OVERHEAD;
+		if (s >= SMALL_BLOCK_SIZE)
+			grow += 1 << (fls(s) - SL_LOG2);
+		
+		/* The last free block is merged with the new pages */
+		if (_is_prev_free(sentinel) && _size(sentinel->prev_phys) < grow)
+			grow -= _size(sentinel->prev_phys);
+		
+		if (heap_grow(grow < HEAP_GROW_MIN ? HEAP_GROW_MIN : grow) < 0)
+			return 0;
+		
+		mapping_search(s, &fl, &sl);
+		b = find_suitable_block(&fl, &sl);
+		if (!b)
+			return 0;
+	}
+	
+	remove_free_block(b, fl, sl);
+	
+	return b;
+}
+
+static void *
+use_block(kheap_block_t *b, u32 s)
+{
+	mark_used(b);
+	split(b, s);
+	
+	stats.used += _size(b);
+	if (stats.used > stats.used_peak)
+		stats.used_peak = stats.used;
+	
+	return (void *) _block_base(b);
+}
+
+static void *
+do_kmalloc(u32 s)
+{
+	if (s == 0 || s >= (1U << FL_MAX_LOG2)) {
+		return 0;
+	}
+	
+	s = adjust_size(s);
+	
+	kheap_block_t *b = take_block(s);
+	
+	return b ? use_block(b, s) : 0;
+}
+
+static void *
+do_kmalloc_aligned(u32 s, u32 align)
+{
+	if (align <= ALIGN_SIZE) {
+		return do_kmalloc(s);
+	}
+	
+	if (s == 0 || (align & (align - 1)) != 0 ||
+		s + align >= (1U << FL_MAX_LOG2)) {
+		return 0;
+	}
+	
+	s = adjust_size(s);
+	
+	/* Leave room for a free block in front of the aligned one */
+	kheap_block_t *b = take_block(s + align + sizeof(kheap_block_t));
+	if (!b) {
+		return 0;
+	}
+	
+	u32 base = _block_base(b);
+	u32 aligned = (base + align - 1) & ~(align - 1);
+	
+	if (aligned != base) {
+		if (aligned - base < sizeof(kheap_block_t)) {
+			aligned = (base + sizeof(kheap_block_t) + align - 1) & ~(align - 1);
+		}
+		
+		u32 gap = aligned - base;
+		kheap_block_t *front = b;
+		
+		b = _from_base((void *) aligned);
+		b->prev_phys = front;
+		b->size = (_size(front) - gap) | FLAGS_FREE | FLAGS_PREV_FREE;
+		_next(b)->prev_phys = b;
+		
+		front->size = (gap - BLOCK_OVERHEAD) | (front->size & FLAGS_MASK);
+		insert_free_block(front);
+	}
+	
+	return use_block(b, s);
+}
+
+#ifdef ALLOC_PROFILE
+static void *
+profile_block(void *p, u32 caller, u64 start)
 {
-	return b->flags & FLAGS_USED;
+	if (p) {
+		kheap_block_t *b = _from_base(p);
+		b->site = profile_alloc(PROFILE_KMALLOC, caller, _size(b), rdtsc() - start);
+	}
+	
+	return p;
 }
+#endif
 
 void *
 kmalloc(unsigned int s)
 {
-	kheap_block_t *cur = heap;
-	
-	while (cur) {
-		if (!_is_used(cur)) {
-			i64 size_diff = (i64)cur->size - s;
-			if (size_diff > sizeof(kheap_block_t)) {
-				cur->size = s;
-				kheap_block_t *new = _next(cur);
-				new->size = size_diff - sizeof(kheap_block_t);
-				new->flags = cur->flags;
-				cur->flags &= ~FLAGS_LAST;
+#ifdef ALLOC_PROFILE
+	u64 start = rdtsc();
+	return profile_block(do_kmalloc(s), PROFILE_CALLER(), start);
+#else
+	return do_kmalloc(s);
+#endif
+}
+
+void *
+kmalloc_aligned(unsigned int s, unsigned int align)
+{
+#ifdef ALLOC_PROFILE
+	u64 start = rdtsc();
+	return profile_block(do_kmalloc_aligned(s, align), PROFILE_CALLER(), start);
+#else
+	return do_kmalloc_aligned(s, align);
+#endif
+}
+
+void
+kfree(void *p)
+{
+	if (!p) {
+		return;
+	}
+	
+	kheap_block_t *b = _from_base(p);
+	
+	if (_is_free(b)) {
+		kprintf("[ERROR] kfree: double free of 0x%x\n", (u32) p);
+		return;
+	}
+	
+	stats.used -= _size(b);
+#ifdef ALLOC_PROFILE
+	profile_free(b->site, _size(b));
+#endif
+	
+	mark_free(b);
+	b = merge(b);
+	insert_free_block(b);
+}
+
+#ifdef KMALLOC_SELFTEST
+
+#define SELFTEST_SLOTS		64
+#define SELFTEST_ROUNDS		4096
+#define SELFTEST_SIZE_MAX	(4 * PAGE_SIZE)
+
+static u32 selftest_seed = 0x2545F491;
+
+/* xorshift32, good enough to mix the allocation patterns */
+static u32
+selftest_rand()
+{
+	selftest_seed ^= selftest_seed << 13;
+	selftest_seed ^= selftest_seed >> 17;
+	selftest_seed ^= selftest_seed << 5;
+	
+	return selftest_seed;
+}
+
+static u32
+selftest_size()
+{
+	u32 r = selftest_rand();
+	
+	/* Mostly small blocks, some spanning pages */
+	if (r & 0x3)
+		return (r >> 8) % 256 + 1;
+	
+	return (r >> 8) % SELFTEST_SIZE_MAX + 1;
+}
+
+/*
+ * Walk the heap and the free lists and check that they agree with each other
+ * and with the stats. Return the number of errors found.
+ */
+static int
+check_heap()
+{
+	int errors = 0;
+	u32 used = 0, free_blocks = 0, listed = 0;
+	kheap_block_t *prev = 0;
+	
+	for (kheap_block_t *b = (kheap_block_t *) KHEAP_START; b != sentinel;
+		 b = _next(b)) {
+		if (_block_base(b) + _size(b) > heap_end - BLOCK_OVERHEAD ||
+			_size(b) % ALIGN_SIZE != 0) {
+			kprintf("[ERROR] kmalloc: block 0x%x out of the heap\n", (u32) b);
+			return errors + 1;
+		}
+		
+		if (_is_prev_free(b) && b->prev_phys != prev) {
+			kprintf("[ERROR] kmalloc: bad prev_phys at 0x%x\n", (u32) b);
+			errors++;
+		}
+		
+		if (!!_is_prev_free(b) != (prev && _is_free(prev))) {
+			kprintf("[ERROR] kmalloc: bad prev free flag at 0x%x\n", (u32) b);
+			errors++;
+		}
+		
+		if (_is_free(b)) {
+			if (prev && _is_free(prev)) {
+				kprintf("[ERROR] kmalloc: unmerged free blocks at 0x%x\n",
+						(u32) b);
+				errors++;
 			}
+			free_blocks++;
+		} else {
+			used += _size(b);
+		}
+		
+		prev = b;
+	}
+	
+	if (!!_is_prev_free(sentinel) != (prev && _is_free(prev)) ||
+		(_is_prev_free(sentinel) && sentinel->prev_phys != prev)) {
+		kprintf("[ERROR] kmalloc: bad prev free flag on the sentinel\n");
+		errors++;
+	}
+	
+	if (used != stats.used) {
+		kprintf("[ERROR] kmalloc: %d bytes used, stats say %d\n", used,
+				stats.used);
+		errors++;
+	}
+	
+	if (heap_end - KHEAP_START != stats.heap_size) {
+		kprintf("[ERROR] kmalloc: heap of %d bytes, stats say %d\n",
+				heap_end - KHEAP_START, stats.heap_size);
+		errors++;
+	}
+	
+	for (int fl = 0; fl < FL_COUNT; fl++) {
+		if (!!(fl_bitmap & (1 << fl)) != !!sl_bitmap[fl]) {
+			kprintf("[ERROR] kmalloc: first level bitmap wrong at %d\n", fl);
+			errors++;
+		}
+		
+		for (int sl = 0; sl < SL_COUNT; sl++) {
+			kheap_block_t *b = free_lists[fl][sl];
 			
-			if (cur->size >= s) {
-				cur->flags |= FLAGS_USED;				
-				return (void *) _block_base(cur);
+			if (!!(sl_bitmap[fl] & (1 << sl)) != !!b) {
+				kprintf("[ERROR] kmalloc: second level bitmap wrong at %d,%d\n",
+						fl, sl);
+				errors++;
+			}
+			
+			for (kheap_block_t *p = 0; b; p = b, b = b->next_free) {
+				int f, s;
+				
+				mapping_insert(_size(b), &f, &s);
+				
+				if (!_is_free(b) || b->prev_free != p || f != fl || s != sl) {
+					kprintf("[ERROR] kmalloc: bad free list entry 0x%x\n",
+							(u32) b);
+					errors++;
+					break;
+				}
+				
+				listed++;
 			}
 		}
-		
-		if (_is_last(cur)) {
-			cur = 0;
-		} else {
-			cur = _next(cur);
+	}
+	
+	if (listed != free_blocks) {
+		kprintf("[ERROR] kmalloc: %d free blocks, %d in the free lists\n",
+				free_blocks, listed);
+		errors++;
+	}
+	
+	return errors;
+}
+
+/* Check that the block at @p still holds the pattern written for @tag */
+static int
+check_pattern(const u8 *p, u32 size, u8 tag)
+{
+	for (u32 i = 0; i < size; i++) {
+		if (p[i] != (u8) (tag + i)) {
+			kprintf("[ERROR] kmalloc: block 0x%x overwritten\n", (u32) p);
+			return 1;
 		}
 	}
 	
 	return 0;
 }
+
+static void
+fill_pattern(u8 *p, u32 size, u8 tag)
+{
+	for (u32 i = 0; i < size; i++)
+		p[i] = tag + i;
+}
+
+int
+kmalloc_selftest()
+{
+	u8 *blocks[SELFTEST_SLOTS];
+	u32 sizes[SELFTEST_SLOTS];
+	u32 used = stats.used;
+	int errors = check_heap();
+	
+	memset(blocks, 0, sizeof(blocks));
+	
+	for (int round = 0; round < SELFTEST_ROUNDS && !errors; round++) {
+		int i = selftest_rand() % SELFTEST_SLOTS;
+		u32 op = selftest_rand() % 4;
+		u8 tag = (u8) i;
+		
+		if (blocks[i])
+			errors += check_pattern(blocks[i], sizes[i], tag);
+		
+		if (blocks[i] && op == 0) {
+			kfree(blocks[i]);
+			blocks[i] = 0;
+		} else if (blocks[i] && op == 1) {
+			/* No krealloc(), move the block like a caller would */
+			u32 size = selftest_size();
+			u8 *p = kmalloc(size);
+			
+			if (!p) {
+				kprintf("[ERROR] kmalloc: can't allocate %d bytes\n", size);
+				errors++;
+				continue;
+			}
+			
+			memcpy(p, blocks[i], size < sizes[i] ? size : sizes[i]);
+			kfree(blocks[i]);
+			
+			if (size > sizes[i])
+				fill_pattern(p + sizes[i], size - sizes[i], tag + sizes[i]);
+			
+			blocks[i] = p;
+			sizes[i] = size;
+		} else if (!blocks[i]) {
+			u32 size = selftest_size();
+			u32 align = op == 2 ? 1 << (selftest_rand() % 13) : ALIGN_SIZE;
+			
+			blocks[i] = align > ALIGN_SIZE ? kmalloc_aligned(size, align) :
+											 kmalloc(size);
+			
+			if (!blocks[i] || (u32) blocks[i] % align != 0) {
+				kprintf("[ERROR] kmalloc: bad block 0x%x for %d bytes aligned "
+						"on %d\n", (u32) blocks[i], size, align);
+				errors++;
+				continue;
+			}
+			
+			sizes[i] = size;
+			fill_pattern(blocks[i], size, tag);
+		}
+		
+		if (round % 64 == 0)
+			errors += check_heap();
+	}
+	
+	for (int i = 0; i < SELFTEST_SLOTS; i++) {
+		if (blocks[i]) {
+			errors += check_pattern(blocks[i], sizes[i], (u8) i);
+			kfree(blocks[i]);
+		}
+	}
+	
+	errors += check_heap();
+	
+	if (stats.used != used) {
+		kprintf("[ERROR] kmalloc: %d bytes leaked\n", stats.used - used);
+		errors++;
+	}
+	
+	kmalloc_trim();
+	errors += check_heap();
+	
+	kprintf("kmalloc self-test: %d rounds, heap peak %d bytes, %d errors\n",
+			SELFTEST_ROUNDS, stats.heap_peak, errors);
+	
+	return errors ? -1 : 0;
+}
+
+#endif
@@ -1,32 +1,53 @@
 #include <alien/memory/paging.h>
+#include <alien/memory/kmalloc.h>
+#include <alien/memory/alloc_profile.h>
 #include <alien/kernel.h>
 #include <alien/io.h>
 #include <alien/string.h>
+#include <alien/fpu.h>
+#include <alien/smp.h>
+#include <alien/preempt.h>
 
-#define PAGE_SIZE	0x1000
+#define PAGETABLE_VADDR(i)		((1023 << 22) + ((i) << 12))
+#define PAGE_ENTRY_BASE(e) 		((e) & 0xFFFFF000)
+#define PAGEDIR_INDEX(base) 	(((base) & 0xFFC00000) >> 22)
+#define PAGETABLE_INDEX(base) 	(((base) & 0x003FF000) >> 12)
 
-#define PAGETABLE_VADDR(i)		((1023 << 22) + (i << 12))
-#define PAGE_ENTRY_BASE(e) 		(e & 0xFFFFF000)
-#define PAGEDIR_INDEX(base) 	((base & 0xFFC00000) >> 22)
-#define PAGETABLE_INDEX(base) 	((base & 0x003FF000) >> 12)
+#define PAGEDIR_CACHE_SIZE		16
+#define PAGETABLE_CACHE_SIZE	64
 
-static u8  bitmap_size = 0;
+static u32 bitmap_size = 0;
 static u8 *bitmap;
+static u8 *frame_refs;
+#ifdef ALLOC_PROFILE
+static u16 *frame_sites;		/* Allocation site of each frame */
+#endif
 static u32 kernel_pagedir[1024] __attribute__ ((aligned (PAGE_SIZE)));
-static u32 *current_pagedir = (u32 *) 0xFFFFF000;
+static u32 *current_pagedir = CURRENT_PAGEDIR;
 
-static inline void
-invlpg(u32 page)
-{
-	asm volatile ("invlpg (%0)" :: "r" (page) : "memory");
-}
+/*
+ * Frames of released page directories and page tables are kept on small
+ * stacks so that address space creation and teardown don't go through the
+ * frame allocator. Cached page tables are always zeroed. Cached page
+ * directories have an empty user half and a copy of the kernel half taken
+ * at generation pagedir_cache_gen[i]; kernel_pde_gen changes each time a
+ * kernel page table is added, which makes older copies stale.
+ */
+static u32 pagedir_cache[PAGEDIR_CACHE_SIZE];
+static u32 pagedir_cache_gen[PAGEDIR_CACHE_SIZE];
+static u32 pagedir_cache_count = 0;
+static u32 pagetable_cache[PAGETABLE_CACHE_SIZE];
+static u32 pagetable_cache_count = 0;
+static u32 kernel_pde_gen = 0;
+
+static u32 zero_frame = 0;
 
 static void
 write_page_entry(u32 *structure, u32 i, u32 frame, u8 user)
 {
 	structure[i] = (frame & 0xFFFFF000);
-	structure[i] |= 1;
-	structure[i] |= 2; /* R/W */
+	structure[i] |= PAGE_PRESENT;
+	structure[i] |= PAGE_RW;
 	structure[i] |= ((user & 0x1) << 2);
 }
 
@@ -73,16 +94,27 @@ first_page_free(u32 *structure, u32 base)
 }
 
 static u32
-alloc_frame()
+do_alloc_frame()
 {
 	u32 i = 0, j = 0;
 	
-	while (bitmap[i] == 0xFF) {
+	while (i < bitmap_size && bitmap[i] == 0xFF) {
 		i++;
 	}
 	
 	if (i == bitmap_size) {
-		return 0;
+		/* Under memory pressure, take back the idle heap pages once */
+		static u8 reclaiming = 0;
+		
+		if (reclaiming || kmalloc_trim() == 0) {
+			return 0;
+		}
+		
+		reclaiming = 1;
+		u32 frame = do_alloc_frame();
+		reclaiming = 0;
+		
+		return frame;
 	}
 	
 	while (bitmap[i] & (1 << j)) {
@@ -93,19 +125,84 @@ alloc_frame()
 		return 0;
 	
 	bitmap[i] |= (1 << j);
+	frame_refs[i * 8 + j] = 1;
 	
 	return (i * 8 + j) * PAGE_SIZE;
 }
 
-static void
+u32
+alloc_frame()
+{
+#ifdef ALLOC_PROFILE
+	u64 start = rdtsc();
+	u32 frame = do_alloc_frame();
+	
+	if (frame) {
+		frame_sites[frame / PAGE_SIZE] = profile_alloc(PROFILE_FRAME, PROFILE_CALLER(),
+													   PAGE_SIZE, rdtsc() - start);
+	}
+	
+	return frame;
+#else
+	return do_alloc_frame();
+#endif
+}
+
+void
 free_frame(u32 frame)
 {
 	u32 i = frame / (PAGE_SIZE * 8);
 	u32 j = (frame / PAGE_SIZE) % 8;
 	
+#ifdef ALLOC_PROFILE
+	profile_free(frame_sites[frame / PAGE_SIZE], PAGE_SIZE);
+	frame_sites[frame / PAGE_SIZE] = 0;
+#endif
+	
+	frame_refs[frame / PAGE_SIZE] = 0;
 	bitmap[i] &= ~(1 << j);
 }
 
+int
+get_frame(u32 frame)
+{
+	u8 *refs = &frame_refs[frame / PAGE_SIZE];
+	
+	if (frame == zero_frame) {
+		return 0;
+	}
+	
+	if (*refs == 0xFF) {
+		return -1;
+	}
+	
+	(*refs)++;
+	
+	return 0;
+}
+
+u32
+frame_ref_count(u32 frame)
+{
+	return frame_refs[frame / PAGE_SIZE];
+}
+
+void
+put_frame(u32 frame)
+{
+	u8 *refs = &frame_refs[frame / PAGE_SIZE];
+	
+	if (frame == zero_frame) {
+		return;
+	}
+	
+	if (*refs <= 1) {
+		free_frame(frame);
+	} else {
+		(*refs)--;
+	}
+}
+
 static u8
 pagetable_is_empty(u32 *table)
 {
@@ -132,6 +229,74 @@ phys_addr(u32 *dir, u32 page)
 	return frame;
 }
 
+/* @frame must be a zeroed page table */
+static void
+free_pagetable(u32 frame)
+{
+	if (pagetable_cache_count < PAGETABLE_CACHE_SIZE) {
+		pagetable_cache[pagetable_cache_count++] = frame;
+	} else {
+		free_frame(frame);
+	}
+}
+
+static u32
+add_pagetable(u32 pd_idx, u32 flags)
+{
+	u8 zeroed = pagetable_cache_count > 0;
+	u32 new_frame = zeroed ? pagetable_cache[--pagetable_cache_count]
+						   : alloc_frame();
+	if (new_frame == 0)
+		return 0;
+	write_page_entry(current_pagedir, pd_idx, new_frame,
+					 (flags & PAGE_USER) != 0);
+	invlpg(PAGETABLE_VADDR(pd_idx));
+	
+	if (!zeroed) {
+		memset((u32 *) PAGETABLE_VADDR(pd_idx), 0, PAGE_SIZE);
+	}
+	
+	if (pd_idx >= PAGEDIR_INDEX(kinfo.vbase)) {
+		kernel_pde_gen++;
+	}
+	
+	return new_frame;
+}
+
+static u32
+map_entry(u32 page, u32 frame, u32 flags)
+{
+	u32 pd_idx = PAGEDIR_INDEX(page);
+	u32 pt_idx = PAGETABLE_INDEX(page);
+	
+	if (!page_entry_is_present(current_pagedir, pd_idx) &&
+		!add_pagetable(pd_idx, flags)) {
+		return 0;
+	}
+
+	if (flags & PAGE_USER) {
+		current_pagedir[pd_idx] |= PAGE_USER;
+	}
+
+	u32 *pagetable = (u32 *) PAGETABLE_VADDR(pd_idx);
+	
+	pagetable[pt_idx] = PAGE_ENTRY_BASE(frame) | PAGE_PRESENT |
+						(flags & PAGE_FLAGS);
+
+	return page;
+}
+
+int
+reserve_kernel_range(u32 start, u32 end)
+{
+	for (u32 i = PAGEDIR_INDEX(start); i <= PAGEDIR_INDEX(end - 1); i++) {
+		if (!page_entry_is_present(current_pagedir, i) && !add_pagetable(i, 0))
+			return -1;
+	}
+	
+	return 0;
+}
+
 u32
 map(u32 frame, u32 offset, u32 user)
 {
@@ -142,21 +307,100 @@ map(u32 frame, u32 offset, u32 user)
 	if (page == 0)
 		return 0;
 	
+	return map_entry(page, frame, PAGE_RW | (user ? PAGE_USER : 0));
+}
+
+u32 *
+page_entry(u32 page)
+{
+	if (!page_entry_is_present(current_pagedir, PAGEDIR_INDEX(page))) {
+		return (u32 *) 0;
+	}
 	
+	return (u32 *) PAGETABLE_VADDR(PAGEDIR_INDEX(page)) + PAGETABLE_INDEX(page);
+}
+
+u32
+map_in(u32 pagedir_frame, u32 page, u32 frame, u32 flags)
+{
 	u32 pd_idx = PAGEDIR_INDEX(page);
 	u32 pt_idx = PAGETABLE_INDEX(page);
+	u32 ret = 0;
+	
+	if (pagedir_frame == phys_addr(current_pagedir, (u32) current_pagedir)) {
+		return map_at(page, frame, flags);
+	}
 	
-	if (!page_entry_is_present(current_pagedir, pd_idx)) {
-		u32 new_frame = alloc_frame();
-		if (new_frame == 0)
+	u32 *pagedir = (u32 *) map(pagedir_frame, kinfo.vbase, 0);
+	if (!pagedir)
+		return 0;
+	
+	if (!page_entry_is_present(pagedir, pd_idx)) {
+		u8 zeroed = pagetable_cache_count > 0;
+		u32 table_frame = zeroed ? pagetable_cache[--pagetable_cache_count]
+								 : alloc_frame();
+		if (table_frame == 0) {
+			unmap((u32) pagedir);
 			return 0;
-		write_page_entry(current_pagedir, pd_idx, new_frame, user);
+		}
+		
+		write_page_entry(pagedir, pd_idx, table_frame, 0);
+		
+		if (!zeroed) {
+			u32 *table = (u32 *) map(table_frame, kinfo.vbase, 0);
+			memset(table, 0, PAGE_SIZE);
+			unmap((u32) table);
+		}
+	}
+	
+	if (flags & PAGE_USER) {
+		pagedir[pd_idx] |= PAGE_USER;
 	}
+	
+	u32 *table = (u32 *) map(PAGE_ENTRY_BASE(pagedir[pd_idx]), kinfo.vbase, 0);
+	
+	if (!page_entry_is_present(table, pt_idx)) {
+		table[pt_idx] = PAGE_ENTRY_BASE(frame) | PAGE_PRESENT |
+						(flags & PAGE_FLAGS);
+		ret = page;
+	}
+	
+	unmap((u32) table);
+	unmap((u32) pagedir);
+	
+	return ret;
+}
 
-	u32 *pagetable = (u32 *) PAGETABLE_VADDR(pd_idx);
+u32
+get_zero_frame()
+{
+	if (zero_frame == 0) {
+		u32 frame = alloc_frame();
+		u32 page = map(frame, kinfo.vbase, 0);
+		
+		if (page == 0) {
+			return 0;
+		}
+		
+		memset((u32 *) page, 0, PAGE_SIZE);
+		unmap(page);
+		zero_frame = frame;
+	}
 	
-	write_page_entry(pagetable, pt_idx, frame, user);	
+	return zero_frame;
+}
 
+u32
+map_at(u32 page, u32 frame, u32 flags)
+{
+	if (frame == 0 || phys_addr(current_pagedir, page))
+		return 0;
+	
+	if (!map_entry(page, frame, flags))
+		return 0;
+	
+	invlpg(page);
+	
 	return page;
 }
 
@@ -166,12 +410,20 @@ unmap(u32 page)
 	u32 *pagetable = (u32 *) PAGETABLE_VADDR(PAGEDIR_INDEX(page));
 	clear_page_entry(pagetable, PAGETABLE_INDEX(page));
 	
-	if (pagetable_is_empty(pagetable)) {
-		free_frame(PAGE_ENTRY_BASE(current_pagedir[PAGEDIR_INDEX(page)]));
+	/* Kernel page tables are shared by every page directory */
+	if (page < kinfo.vbase && pagetable_is_empty(pagetable)) {
+		free_pagetable(PAGE_ENTRY_BASE(current_pagedir[PAGEDIR_INDEX(page)]));
 		clear_page_entry(current_pagedir, PAGEDIR_INDEX(page));
 	}
 	
 	invlpg(page);
+	
+	/* Other CPUs may have the page in their TLB if it's shared by every
+	 * page directory, they flush it in lock_kernel() */
+	if (page >= kinfo.vbase ||
+		PAGE_ENTRY_BASE(current_pagedir[1023]) == kernel_pagedir_frame()) {
+		this_cpu()->tlb_gen = ++kernel_tlb_gen;
+	}
 }
 
 u32
@@ -188,7 +440,7 @@ free_page(u32 page)
 	u32 *pagetable = (u32 *) PAGETABLE_VADDR(PAGEDIR_INDEX(page));
 	
 	u32 frame = PAGE_ENTRY_BASE(pagetable[PAGETABLE_INDEX(page)]);
-	free_frame(frame);
+	put_frame(frame);
 	
 	unmap(page);
 }
@@ -206,10 +458,22 @@ init_paging()
 {
 	u32 total_frame_count = updiv(kinfo.memlen, PAGE_SIZE);
 	bitmap_size = updiv(total_frame_count, 8);	
-	u32 used_frame_count = updiv(kinfo.len + bitmap_size, PAGE_SIZE);
+	u32 frame_data_size = total_frame_count;
+#ifdef ALLOC_PROFILE
+	frame_data_size += total_frame_count * sizeof(u16);
+#endif
+	u32 used_frame_count = updiv(kinfo.len + bitmap_size + frame_data_size,
+								 PAGE_SIZE);
 	bitmap = (u8 *) kinfo.len + kinfo.vbase;
+	frame_refs = bitmap + bitmap_size;
 	
-	u32 pagetable_addr = ((u32) bitmap) + bitmap_size;
+	memset(bitmap, 0, bitmap_size);
+	memset(frame_refs, 0, frame_data_size);
+#ifdef ALLOC_PROFILE
+	frame_sites = (u16 *) (frame_refs + total_frame_count);
+#endif
+	
+	u32 pagetable_addr = ((u32) frame_refs) + frame_data_size;
 	align(pagetable_addr, PAGE_SIZE);
 	memset((u32 *) pagetable_addr, 0, PAGE_SIZE);
 	
@@ -220,6 +484,7 @@ init_paging()
 
 	for (u32 i = 0; i < used_frame_count; i++) {		
 		bitmap[i / 8] |= 1 << (i % 8);
+		frame_refs[i] = 1;
 	}
 	
 	for (u32 i = 0; i < used_frame_count - 1; i++) {
@@ -235,6 +500,12 @@ init_paging()
 	switch_page_dir(((u32)kernel_pagedir) - kinfo.vbase);
 }
 
+u32
+kernel_pagedir_frame()
+{
+	return (u32) kernel_pagedir - kinfo.vbase;
+}
+
 void
 switch_page_dir(u32 dir)
 {
@@ -242,24 +513,83 @@ switch_page_dir(u32 dir)
     __switch_pagedir(dir);
 }
 
+static void
+copy_kernel_pdes(u32 *pagedir, u32 pagedir_frame)
+{
+	memcpy(&pagedir[PAGEDIR_INDEX(kinfo.vbase)],
+			&current_pagedir[PAGEDIR_INDEX(kinfo.vbase)],
+			(1024 - PAGEDIR_INDEX(kinfo.vbase)) * 4);
+	
+	write_page_entry(pagedir, 1023, pagedir_frame, 0);
+}
+
 u32
 create_user_pagedir()
 {
+	if (pagedir_cache_count > 0) {
+		u32 i = --pagedir_cache_count;
+		u32 pagedir_frame = pagedir_cache[i];
+		
+		if (pagedir_cache_gen[i] != kernel_pde_gen) {
+			u32 *pagedir = (u32 *) map(pagedir_frame, kinfo.vbase, 0);
+			copy_kernel_pdes(pagedir, pagedir_frame);
+			unmap((u32) pagedir);
+		}
+		
+		return pagedir_frame;
+	}
+	
 	u32 pagedir_frame = alloc_frame();	
 	u32 *pagedir = (u32 *) map(pagedir_frame, kinfo.vbase, 0);
 	
 	memset(pagedir, 0, 4096);
-	memcpy(&pagedir[PAGEDIR_INDEX(kinfo.vbase)],
-			&current_pagedir[PAGEDIR_INDEX(kinfo.vbase)],
-			(1024 - PAGEDIR_INDEX(kinfo.vbase)) * 4);
-	
-	write_page_entry(pagedir, 1023, pagedir_frame, 0);
+	copy_kernel_pdes(pagedir, pagedir_frame);
 	
 	unmap((u32) pagedir);
 		
 	return pagedir_frame;
 }
 
+void
+free_user_pagedir(u32 pagedir_frame)
+{
+	u32 *pagedir = (u32 *) map(pagedir_frame, kinfo.vbase, 0);
+	
+	for (u32 i = 0; i < PAGEDIR_INDEX(kinfo.vbase); i++) {
+		if (!page_entry_is_present(pagedir, i))
+			continue;
+		
+		u32 table_frame = PAGE_ENTRY_BASE(pagedir[i]);
+		u32 *table = (u32 *) map(table_frame, kinfo.vbase, 0);
+		
+		for (u32 j = 0; j < 1024; j++) {
+			if (page_entry_is_present(table, j)) {
+				put_frame(PAGE_ENTRY_BASE(table[j]));
+				clear_page_entry(table, j);
+			}
+		}
+		
+		unmap((u32) table);
+		free_pagetable(table_frame);
+		clear_page_entry(pagedir, i);
+	}
+	
+	/* The kernel half was copied when the directory was created, kernel
+	 * page tables may have been added since */
+	if (pagedir_cache_count < PAGEDIR_CACHE_SIZE) {
+		copy_kernel_pdes(pagedir, pagedir_frame);
+	}
+	
+	unmap((u32) pagedir);
+	
+	if (pagedir_cache_count < PAGEDIR_CACHE_SIZE) {
+		pagedir_cache_gen[pagedir_cache_count] = kernel_pde_gen;
+		pagedir_cache[pagedir_cache_count++] = pagedir_frame;
+	} else {
+		free_frame(pagedir_frame);
+	}
+}
+
 u32
 copy_current_pagedir()
 {
@@ -277,13 +607,32 @@ copy_current_pagedir()
 				if (page_entry_is_present(pagetable, j)) {
 					u32 base = PAGE_ENTRY_BASE(pagetable[j]);
 					
-					if (base != (u32)old_pagedir && base != (u32)pagetable) {						
+					if (pagetable[j] & PAGE_SHARED) {
+						/* A frame mapped too many times is left out of
+						 * the copy */
+						if (get_frame(base) < 0) {
+							kprintf("[ERROR] copy_current_pagedir: frame 0x%x has too many references\n",
+									base);
+						} else if (!map_at((i << 22) + (j << 12), base,
+										   pagetable[j] & PAGE_FLAGS)) {
+							put_frame(base);
+						}
+					} else if (base != (u32)old_pagedir && base != (u32)pagetable) {						
 						u32 new_page = alloc_page((i << 22) + (j << 12), 1);
 						u32 old_page = map(base, PAGE_SIZE, 0);
 						
-						memcpy((u32 *) new_page, (u32 *) old_page, PAGE_SIZE);
+						copy_page((void *) new_page, (void *) old_page);
 						
 						unmap(old_page);
+						
+						/* Don't hold the CPU for the whole address space,
+						 * the task is switched back to its own page
+						 * directory if it's preempted */
+						cond_resched();
+						
+						if (PAGE_ENTRY_BASE(current_pagedir[1023]) != new_pagedir_phys) {
+							switch_page_dir(new_pagedir_phys);
+						}
 					}
 				}
 			}
@@ -0,0 +1,197 @@
+#include <alien/memory/shm.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/kmalloc.h>
+#include <alien/kernel.h>
+#include <alien/string.h>
+
+/*
+ * An object holds one reference on each of its frames, and each mapping one
+ * more. Once unlinked, the object keeps its slot until it isn't mapped
+ * anymore.
+ */
+struct shm_object {
+	char name[SHM_NAME_MAX];
+	u32  page_count;
+	u32 *frames;
+	u8   unlinked;
+};
+
+static struct shm_object objects[SHM_MAX];
+
+static struct shm_object *
+shm_get(int id)
+{
+	if (id < 0 || id >= SHM_MAX || !objects[id].frames || objects[id].unlinked) {
+		return (struct shm_object *) 0;
+	}
+	
+	return &objects[id];
+}
+
+static int
+shm_find(const char *name)
+{
+	for (int i = 0; i < SHM_MAX; i++) {
+		if (objects[i].frames && !objects[i].unlinked &&
+			!strcmp(objects[i].name, name)) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+static void
+shm_release(struct shm_object *obj, u32 count)
+{
+	for (u32 i = 0; i < count; i++) {
+		put_frame(obj->frames[i]);
+	}
+	
+	kfree(obj->frames);
+	obj->frames = 0;
+	obj->page_count = 0;
+	obj->unlinked = 0;
+}
+
+/* Return 1 if only the object references its frames. Mappings also go away
+ * when their task exits, so this is checked rather than counted. */
+static int
+shm_unmapped(struct shm_object *obj)
+{
+	return frame_ref_count(obj->frames[0]) == 1;
+}
+
+/* Free the slot of an unlinked object once it's not mapped anymore */
+static void
+shm_reclaim(struct shm_object *obj)
+{
+	if (obj->frames && obj->unlinked && shm_unmapped(obj)) {
+		shm_release(obj, obj->page_count);
+	}
+}
+
+int
+shm_open(const char *name, u32 size)
+{
+	int id = shm_find(name);
+	
+	if (id >= 0) {
+		return id;
+	}
+	
+	if (size == 0 || strlen(name) >= SHM_NAME_MAX) {
+		return -1;
+	}
+	
+	for (id = 0; id < SHM_MAX; id++) {
+		shm_reclaim(&objects[id]);
+		
+		if (!objects[id].frames)
+			break;
+	}
+	
+	if (id == SHM_MAX) {
+		return -1;
+	}
+	
+	struct shm_object *obj = &objects[id];
+	u32 page_count = updiv(size, PAGE_SIZE);
+	
+	obj->frames = (u32 *) kmalloc(page_count * sizeof(u32));
+	if (!obj->frames) {
+		return -1;
+	}
+	
+	for (u32 i = 0; i < page_count; i++) {
+		obj->frames[i] = alloc_frame();
+		
+		if (obj->frames[i] == 0) {
+			shm_release(obj, i);
+			return -1;
+		}
+	}
+	
+	obj->page_count = page_count;
+	strcpy(obj->name, name);
+	
+	return id;
+}
+
+int
+shm_attach(int id, u32 vaddr)
+{
+	struct shm_object *obj = shm_get(id);
+	
+	if (!obj || vaddr % PAGE_SIZE != 0 ||
+		vaddr + obj->page_count * PAGE_SIZE > kinfo.vbase) {
+		return -1;
+	}
+	
+	for (u32 i = 0; i < obj->page_count; i++) {
+		u32 page = vaddr + i * PAGE_SIZE;
+		int mapped = 0;
+		
+		if (get_frame(obj->frames[i]) == 0) {
+			mapped = map_at(page, obj->frames[i],
+							PAGE_USER | PAGE_RW | PAGE_SHARED) != 0;
+			
+			if (!mapped) {
+				put_frame(obj->frames[i]);
+			}
+		}
+		
+		if (!mapped) {
+			while (i-- > 0) {
+				free_page(vaddr + i * PAGE_SIZE);
+			}
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+int
+shm_detach(int id, u32 vaddr)
+{
+	/* Unlinked objects can still be detached */
+	struct shm_object *obj = (id >= 0 && id < SHM_MAX && objects[id].frames) ?
+		&objects[id] : (struct shm_object *) 0;
+	
+	if (!obj || vaddr % PAGE_SIZE != 0) {
+		return -1;
+	}
+	
+	for (u32 i = 0; i < obj->page_count; i++) {
+		if (phys_addr(CURRENT_PAGEDIR, vaddr + i * PAGE_SIZE) != obj->frames[i]) {
+			return -1;
+		}
+	}
+	
+	for (u32 i = 0; i < obj->page_count; i++) {
+		free_page(vaddr + i * PAGE_SIZE);
+	}
+	
+	shm_reclaim(obj);
+	
+	return 0;
+}
+
+int
+shm_unlink(const char *name)
+{
+	struct shm_object *obj = shm_get(shm_find(name));
+	
+	if (!obj) {
+		return -1;
+	}
+	
+	/* The name can be reused right away, the frames stay until the last
+	 * mapping is detached */
+	obj->unlinked = 1;
+	obj->name[0] = '\0';
+	shm_reclaim(obj);
+	
+	return 0;
+}
@@ -0,0 +1,230 @@
+#include <alien/memory/slab.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/kmalloc.h>
+#include <alien/kernel.h>
+
+#define PAGE_BASE(a)	((a) & ~(PAGE_SIZE - 1))
+#define ALIGN_UP(a, b)	(((a) + (b) - 1) & ~((b) - 1))
+
+#define SLAB_OBJ(s, i)	((void *) ((u32) (s) + (s)->cache->offset + \
+									(i) * (s)->cache->size))
+#define SLAB_IDX(s, o)	(((u32) (o) - (u32) (s) - (s)->cache->offset) / \
+									(s)->cache->size)
+
+#define SLAB_END		0xFFFF
+
+/*
+ * A slab is one page: this header, the free list then the objects. The free
+ * list links object indexes so that free objects keep their constructed
+ * state.
+ */
+struct slab {
+	struct kmem_cache *cache;
+	struct slab       *prev, *next;
+	u32                inuse;
+	u16                free;		/* First free object, or SLAB_END */
+	u16                links[];		/* Next free object of each object */
+};
+
+struct kmem_cache {
+	const char        *name;
+	u32                size;
+	u32                offset;		/* Of the first object in a slab */
+	u32                objs_per_slab;
+	kmem_ctor_t        ctor;
+	
+	/* Slabs with free objects, full slabs and empty slabs */
+	struct slab       *partial, *full, *empty;
+	u32                slabs;
+	u32                active_objs;
+	
+	struct kmem_cache *next;
+};
+
+static struct kmem_cache *caches = 0;
+
+static void
+slab_unlink(struct slab **list, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+static void
+slab_push(struct slab **list, struct slab *slab)
+{
+	slab->prev = 0;
+	slab->next = *list;
+	
+	if (*list)
+		(*list)->prev = slab;
+	
+	*list = slab;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, u32 size, u32 flags, kmem_ctor_t ctor)
+{
+	u32 align = (flags & SLAB_HWCACHE_ALIGN) ? CACHE_LINE_SIZE : sizeof(void *);
+	
+	size = ALIGN_UP(size, align);
+	
+	u32 count = (PAGE_SIZE - sizeof(struct slab)) / (size + sizeof(u16));
+	u32 offset = ALIGN_UP(sizeof(struct slab) + count * sizeof(u16), align);
+	
+	while (count > 0 && offset + count * size > PAGE_SIZE) {
+		count--;
+		offset = ALIGN_UP(sizeof(struct slab) + count * sizeof(u16), align);
+	}
+	
+	if (count == 0)
+		return (struct kmem_cache *) 0;
+	
+	struct kmem_cache *cache =
+		(struct kmem_cache *) kmalloc(sizeof(struct kmem_cache));
+	if (!cache)
+		return (struct kmem_cache *) 0;
+	
+	cache->name = name;
+	cache->size = size;
+	cache->offset = offset;
+	cache->objs_per_slab = count;
+	cache->ctor = ctor;
+	cache->partial = 0;
+	cache->full = 0;
+	cache->empty = 0;
+	cache->slabs = 0;
+	cache->active_objs = 0;
+	
+	cache->next = caches;
+	caches = cache;
+	
+	return cache;
+}
+
+static struct slab *
+slab_create(struct kmem_cache *cache)
+{
+	struct slab *slab = (struct slab *) alloc_kpage();
+	if (!slab)
+		return (struct slab *) 0;
+	
+	slab->cache = cache;
+	slab->inuse = 0;
+	slab->free = 0;
+	
+	for (u32 i = 0; i < cache->objs_per_slab; i++) {
+		slab->links[i] = i + 1 < cache->objs_per_slab ? i + 1 : SLAB_END;
+		
+		if (cache->ctor)
+			cache->ctor(SLAB_OBJ(slab, i));
+	}
+	
+	cache->slabs++;
+	
+	return slab;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *cache)
+{
+	struct slab *slab = cache->partial;
+	
+	if (!slab) {
+		slab = cache->empty;
+		
+		if (slab) {
+			slab_unlink(&cache->empty, slab);
+		} else if (!(slab = slab_create(cache))) {
+			return 0;
+		}
+		
+		slab_push(&cache->partial, slab);
+	}
+	
+	u16 i = slab->free;
+	slab->free = slab->links[i];
+	slab->inuse++;
+	cache->active_objs++;
+	
+	if (slab->inuse == cache->objs_per_slab) {
+		slab_unlink(&cache->partial, slab);
+		slab_push(&cache->full, slab);
+	}
+	
+	return SLAB_OBJ(slab, i);
+}
+
+void
+kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	struct slab *slab = (struct slab *) PAGE_BASE((u32) obj);
+	
+	if (!obj)
+		return;
+	
+	if (slab->cache != cache) {
+		kprintf("[ERROR] kmem_cache_free: object 0x%x isn't from %s\n",
+				(u32) obj, cache->name);
+		return;
+	}
+	
+	if (slab->inuse == cache->objs_per_slab) {
+		slab_unlink(&cache->full, slab);
+		slab_push(&cache->partial, slab);
+	}
+	
+	u16 i = SLAB_IDX(slab, obj);
+	slab->links[i] = slab->free;
+	slab->free = i;
+	slab->inuse--;
+	cache->active_objs--;
+	
+	if (slab->inuse == 0) {
+		slab_unlink(&cache->partial, slab);
+		slab_push(&cache->empty, slab);
+	}
+}
+
+void
+kmem_cache_shrink(struct kmem_cache *cache)
+{
+	while (cache->empty) {
+		struct slab *slab = cache->empty;
+		
+		slab_unlink(&cache->empty, slab);
+		free_page((u32) slab);
+		cache->slabs--;
+	}
+}
+
+void
+kmem_cache_get_stats(const struct kmem_cache *cache,
+					 struct kmem_cache_stats *stats)
+{
+	stats->name = cache->name;
+	stats->obj_size = cache->size;
+	stats->active_objs = cache->active_objs;
+	stats->total_objs = cache->slabs * cache->objs_per_slab;
+	stats->slabs = cache->slabs;
+}
+
+void
+kmem_cache_dump()
+{
+	struct kmem_cache_stats s;
+	
+	kprintf("cache            size  active   total  slabs  used\n");
+	
+	for (struct kmem_cache *c = caches; c; c = c->next) {
+		kmem_cache_get_stats(c, &s);
+		kprintf("%-16s %4d  %6d  %6d  %5d  %3d%%\n", s.name, s.obj_size,
+				s.active_objs, s.total_objs, s.slabs,
+				s.total_objs ? s.active_objs * 100 / s.total_objs : 0);
+	}
+}
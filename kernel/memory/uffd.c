@@ -0,0 +1,197 @@
+#include <alien/memory/uffd.h>
+#include <alien/memory/vm.h>
+#include <alien/memory/paging.h>
+#include <alien/kernel.h>
+#include <alien/string.h>
+#include <alien/task.h>
+
+#define PAGE_BASE(a)	((a) & ~(PAGE_SIZE - 1))
+
+struct uffd {
+	task_header_t    *owner;		/* 0 if the slot is free */
+	u32               waiting;		/* Page the owner is blocked on, or 0 */
+	struct uffd_event queue[UFFD_QUEUE_SIZE];
+	u32               head, count;
+};
+
+static struct uffd uffds[UFFD_MAX];
+
+static struct uffd *
+uffd_get(int id)
+{
+	if (id < 0 || id >= UFFD_MAX || !uffds[id].owner) {
+		return (struct uffd *) 0;
+	}
+	
+	return &uffds[id];
+}
+
+int
+uffd_create()
+{
+	for (int id = 0; id < UFFD_MAX; id++) {
+		if (!uffds[id].owner) {
+			memset(&uffds[id], 0, sizeof(struct uffd));
+			uffds[id].owner = current_task;
+			return id;
+		}
+	}
+	
+	return -1;
+}
+
+int
+uffd_register(int id, u32 start, u32 len)
+{
+	struct uffd *uffd = uffd_get(id);
+	u32 end = start + len;
+	
+	if (!uffd || uffd->owner != current_task || start % PAGE_SIZE != 0 ||
+		end % PAGE_SIZE != 0 || end <= start) {
+		return -1;
+	}
+	
+	for (u32 addr = start; addr < end; ) {
+		struct vm_area *area = vm_find_area(addr);
+		if (!area || !(area->flags & VM_ANON))
+			return -1;
+		addr = area->end;
+	}
+	
+	return vm_set_uffd(start, len, id);
+}
+
+/*
+ * Faults are handled by the owner or by the children it forked, which
+ * inherit the handler id.
+ */
+static int
+may_handle(const struct uffd *uffd)
+{
+	return current_task == uffd->owner || current_task->parent == uffd->owner;
+}
+
+/*
+ * Return 1 if @page is in an area of the owner registered with @id.
+ */
+static int
+is_registered(const struct uffd *uffd, int id, u32 page)
+{
+	for (struct vm_area *a = uffd->owner->vm_areas; a; a = a->next) {
+		if (page >= a->start && page < a->end)
+			return (a->flags & VM_UFFD) && a->uffd == id;
+	}
+	
+	return 0;
+}
+
+/*
+ * Return 1 if the PAGE_SIZE bytes at @src are mapped user memory of the
+ * current task.
+ */
+static int
+source_ok(u32 src)
+{
+	if (!user_range_ok(src, PAGE_SIZE))
+		return 0;
+	
+	for (u32 page = PAGE_BASE(src); page < src + PAGE_SIZE; page += PAGE_SIZE) {
+		u32 *pte = page_entry(page);
+		
+		if (!pte || (*pte & (PAGE_PRESENT | PAGE_USER)) !=
+			(PAGE_PRESENT | PAGE_USER)) {
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+int
+uffd_read(int id, struct uffd_event *event)
+{
+	struct uffd *uffd = uffd_get(id);
+	
+	if (!uffd || !may_handle(uffd) || uffd->count == 0) {
+		return -1;
+	}
+	
+	*event = uffd->queue[uffd->head];
+	uffd->head = (uffd->head + 1) % UFFD_QUEUE_SIZE;
+	uffd->count--;
+	
+	return 0;
+}
+
+int
+uffd_copy(int id, u32 dst, u32 src)
+{
+	struct uffd *uffd = uffd_get(id);
+	
+	if (!uffd || !may_handle(uffd) || dst % PAGE_SIZE != 0 ||
+		!is_registered(uffd, id, dst) || (src && !source_ok(src))) {
+		return -1;
+	}
+	
+	u32 frame = alloc_frame();
+	u32 page = map(frame, kinfo.vbase, 0);
+	
+	if (!page) {
+		if (frame)
+			free_frame(frame);
+		return -1;
+	}
+	
+	if (src) {
+		memcpy((u32 *) page, (u32 *) src, PAGE_SIZE);
+	} else {
+		memset((u32 *) page, 0, PAGE_SIZE);
+	}
+	
+	unmap(page);
+	
+	if (!map_in(uffd->owner->info.cr3, dst, frame,
+				PAGE_USER | PAGE_RW)) {
+		free_frame(frame);
+		return -1;
+	}
+	
+	if (uffd->waiting == dst) {
+		uffd->waiting = 0;
+		task_wake(uffd->owner);
+	}
+	
+	return 0;
+}
+
+int
+uffd_handle_fault(int id, u32 addr, u32 err)
+{
+	struct uffd *uffd = uffd_get(id);
+	
+	if (!uffd || uffd->owner != current_task ||
+		uffd->count == UFFD_QUEUE_SIZE) {
+		return -1;
+	}
+	
+	struct uffd_event *event =
+		&uffd->queue[(uffd->head + uffd->count) % UFFD_QUEUE_SIZE];
+	
+	event->addr = PAGE_BASE(addr);
+	event->flags = (err & 0x2) ? UFFD_EVENT_WRITE : 0;
+	event->pid = current_task->info.pid;
+	uffd->count++;
+	uffd->waiting = event->addr;
+	
+	return 0;
+}
+
+void
+uffd_release(task_header_t *task)
+{
+	for (int id = 0; id < UFFD_MAX; id++) {
+		if (uffds[id].owner == task) {
+			uffds[id].owner = 0;
+		}
+	}
+}
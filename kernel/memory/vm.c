@@ -0,0 +1,484 @@
+#include <alien/memory/vm.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/slab.h>
+#include <alien/memory/uffd.h>
+#include <alien/kernel.h>
+#include <alien/string.h>
+#include <alien/task.h>
+
+#include <assert.h>
+
+/* Page fault error code bits */
+#define PF_PRESENT	0x1
+#define PF_WRITE	0x2
+#define PF_USER		0x4
+
+#define PAGE_BASE(a)	((a) & ~(PAGE_SIZE - 1))
+
+/* Sequential areas read this many fault-around windows ahead */
+#define READAHEAD_WINDOWS	4
+
+static u32 fault_around_pages = VM_FAULT_AROUND_DEFAULT;
+static struct vm_fault_stats stats;
+static struct kmem_cache *area_cache;
+
+static struct vm_area *
+alloc_area()
+{
+	if (!area_cache) {
+		area_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0, 0);
+		if (!area_cache)
+			return (struct vm_area *) 0;
+	}
+	
+	return (struct vm_area *) kmem_cache_alloc(area_cache);
+}
+
+static inline u8
+page_is_present(u32 page)
+{
+	u32 *pte = page_entry(page);
+	
+	return pte && (*pte & PAGE_PRESENT);
+}
+
+struct vm_area *
+vm_find_area(u32 addr)
+{
+	struct vm_area *area = current_task->vm_areas;
+	
+	while (area && !(addr >= area->start && addr < area->end)) {
+		area = area->next;
+	}
+	
+	return area;
+}
+
+int
+vm_map(u32 start, u32 len, const vfs_node_t *file, u32 offset)
+{
+	u32 end = start + len;
+	
+	if (start % PAGE_SIZE != 0 || len == 0 || end > kinfo.vbase || end < start)
+		return -1;
+	
+	align(end, PAGE_SIZE);
+	
+	for (struct vm_area *a = current_task->vm_areas; a; a = a->next) {
+		if (start < a->end && end > a->start)
+			return -1;
+	}
+	
+	struct vm_area *area = alloc_area();
+	if (!area)
+		return -1;
+	
+	area->start = start;
+	area->end = end;
+	area->offset = offset;
+	
+	if (file) {
+		area->flags = VM_FILE;
+		area->file = *file;
+	} else {
+		area->flags = VM_ANON;
+	}
+	
+	area->next = current_task->vm_areas;
+	current_task->vm_areas = area;
+	
+	return 0;
+}
+
+/*
+ * Count the pages mapped by fault-around that have been accessed since, and
+ * forget they were speculative so they're only counted once.
+ */
+static void
+scan_around_hits(const struct vm_area *area)
+{
+	for (u32 page = area->start; page < area->end; page += PAGE_SIZE) {
+		u32 *pte = page_entry(page);
+		
+		if (pte && (*pte & PAGE_AROUND)) {
+			if (*pte & PAGE_ACCESSED)
+				stats.around_hits++;
+			*pte &= ~PAGE_AROUND;
+		}
+	}
+}
+
+/*
+ * Split @area at @addr so that advice or unmapping applies to part of it
+ * only, and return the area that starts at @addr.
+ */
+static struct vm_area *
+split_area(struct vm_area *area, u32 addr)
+{
+	if (addr <= area->start || addr >= area->end)
+		return area;
+	
+	struct vm_area *tail = alloc_area();
+	if (!tail)
+		return 0;
+	
+	*tail = *area;
+	tail->start = addr;
+	tail->offset += addr - area->start;
+	area->end = addr;
+	area->next = tail;
+	
+	return tail;
+}
+
+int
+vm_unmap(u32 start, u32 len)
+{
+	u32 end = start + len;
+	
+	if (start % PAGE_SIZE != 0 || len == 0 || end > kinfo.vbase || end < start)
+		return -1;
+	
+	align(end, PAGE_SIZE);
+	
+	struct vm_area **link = &current_task->vm_areas;
+	
+	while (*link) {
+		struct vm_area *area = *link;
+		
+		if (start >= area->end || end <= area->start) {
+			link = &area->next;
+			continue;
+		}
+		
+		/* Keep the parts of the area out of the range */
+		if (area->start < start) {
+			if (!split_area(area, start))
+				return -1;
+			link = &area->next;
+			continue;
+		}
+		
+		if (area->end > end && !split_area(area, end))
+			return -1;
+		
+		scan_around_hits(area);
+		
+		for (u32 page = area->start; page < area->end; page += PAGE_SIZE) {
+			if (page_is_present(page))
+				free_page(page);
+		}
+		
+		*link = area->next;
+		kmem_cache_free(area_cache, area);
+	}
+	
+	return 0;
+}
+
+void
+vm_free_areas(struct vm_area *areas)
+{
+	while (areas) {
+		struct vm_area *next = areas->next;
+		kmem_cache_free(area_cache, areas);
+		areas = next;
+	}
+}
+
+struct vm_area *
+vm_copy_areas(const struct vm_area *areas)
+{
+	struct vm_area *copy = 0;
+	struct vm_area **link = &copy;
+	
+	for (; areas; areas = areas->next) {
+		*link = alloc_area();
+		assert(*link);
+		
+		**link = *areas;
+		(*link)->flags &= ~VM_UFFD;
+		link = &(*link)->next;
+	}
+	
+	*link = 0;
+	
+	return copy;
+}
+
+/*
+ * Map @page, which isn't present, with the content of @area. Read accesses
+ * to anonymous memory get the shared zero frame, which is replaced on the
+ * first write.
+ */
+static int
+populate(struct vm_area *area, u32 page, u8 write, u32 flags)
+{
+	flags |= PAGE_USER;
+	
+	if ((area->flags & VM_ANON) && !write) {
+		return map_at(page, get_zero_frame(), flags | PAGE_SHARED) ? 0 : -1;
+	}
+	
+	u32 frame = alloc_frame();
+	
+	if (!map_at(page, frame, flags | PAGE_RW)) {
+		if (frame)
+			free_frame(frame);
+		return -1;
+	}
+	
+	memset((u32 *) page, 0, PAGE_SIZE);
+	
+	if (area->flags & VM_FILE) {
+		vfs_read(&area->file, area->offset + (page - area->start), PAGE_SIZE,
+				 (u8 *) page);
+	}
+	
+	return 0;
+}
+
+static int
+unshare_zero_page(u32 page)
+{
+	u32 *pte = page_entry(page);
+	
+	if (!pte || PAGE_BASE(*pte) != get_zero_frame())
+		return -1;
+	
+	u32 frame = alloc_frame();
+	if (frame == 0)
+		return -1;
+	
+	*pte = frame | PAGE_PRESENT | PAGE_RW | PAGE_USER;
+	invlpg(page);
+	memset((u32 *) page, 0, PAGE_SIZE);
+	
+	return 0;
+}
+
+/*
+ * Map the pages of the naturally aligned window of fault_around_pages pages
+ * around @page which aren't present yet, or of the pages following @page in
+ * sequential areas. They're read-only mapped like a read fault would do, so
+ * this never allocates anonymous memory.
+ */
+static void
+fault_around(struct vm_area *area, u32 page)
+{
+	u32 window = fault_around_pages * PAGE_SIZE;
+	u32 mapped = 0;
+	u32 start, end;
+	
+	if (fault_around_pages <= 1 || (area->flags & VM_RANDOM))
+		return;
+	
+	if (area->flags & VM_SEQUENTIAL) {
+		start = page;
+		end = start + window * READAHEAD_WINDOWS;
+	} else {
+		start = page & ~(window - 1);
+		end = start + window;
+	}
+	
+	if (start < area->start)
+		start = area->start;
+	if (end > area->end || end < start)
+		end = area->end;
+	
+	for (u32 p = start; p < end; p += PAGE_SIZE) {
+		if (p != page && !page_is_present(p) &&
+			populate(area, p, 0, PAGE_AROUND) == 0) {
+			mapped++;
+		}
+	}
+	
+	if (mapped) {
+		stats.around_windows++;
+		stats.around_pages += mapped;
+	}
+}
+
+int
+vm_fault(u32 addr, u32 err)
+{
+	u32 page = PAGE_BASE(addr);
+	struct vm_area *area;
+	
+	/* Kernel accesses to user memory fault here as well, and with CR0.WP
+	 * so do its writes to the shared zero frame */
+	if (!current_task || addr >= kinfo.vbase || !(area = vm_find_area(addr)))
+		return -1;
+	
+	if (err & PF_PRESENT) {
+		if (!(err & PF_WRITE) || unshare_zero_page(page) < 0)
+			return -1;
+	} else if (area->flags & VM_UFFD) {
+		/* The kernel can't wait, syscalls check buffers with vm_prefault() */
+		if (!(err & PF_USER) || uffd_handle_fault(area->uffd, addr, err) < 0)
+			return -1;
+		
+		return VM_FAULT_BLOCK;
+	} else {
+		if (populate(area, page, err & PF_WRITE, 0) < 0)
+			return -1;
+		
+		fault_around(area, page);
+	}
+	
+	stats.faults++;
+	
+	return 0;
+}
+
+int
+vm_prefault(u32 start, u32 len, int write)
+{
+	if (!user_range_ok(start, len))
+		return -1;
+	
+	for (u32 page = PAGE_BASE(start); page < start + len; page += PAGE_SIZE) {
+		u32 *pte = page_entry(page);
+		u32 err = write ? PF_WRITE : 0;
+		
+		if (pte && (*pte & PAGE_PRESENT)) {
+			if (!write || (*pte & PAGE_RW))
+				continue;
+			err |= PF_PRESENT;
+		} else {
+			/* Only the fault handler could populate it, and it may be
+			 * waiting for this very syscall */
+			struct vm_area *area = vm_find_area(page);
+			if (!area || (area->flags & VM_UFFD))
+				return -1;
+		}
+		
+		if (vm_fault(page, err) != 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+void
+vm_set_fault_around(u32 pages)
+{
+	if (pages == 0 || (pages & (pages - 1)) != 0)
+		return;
+	
+	fault_around_pages = pages;
+}
+
+static void
+advise_area(struct vm_area *area, u32 start, u32 end, u32 advice)
+{
+	switch (advice) {
+	case MADV_NORMAL:
+	case MADV_RANDOM:
+	case MADV_SEQUENTIAL:
+		area->flags &= ~(VM_SEQUENTIAL | VM_RANDOM);
+		if (advice == MADV_RANDOM)
+			area->flags |= VM_RANDOM;
+		else if (advice == MADV_SEQUENTIAL)
+			area->flags |= VM_SEQUENTIAL;
+		break;
+	case MADV_WILLNEED:
+		for (u32 page = start; page < end; page += PAGE_SIZE) {
+			if (!page_is_present(page))
+				populate(area, page, area->flags & VM_ANON, 0);
+		}
+		break;
+	case MADV_DONTNEED:
+		for (u32 page = start; page < end; page += PAGE_SIZE) {
+			u32 *pte = page_entry(page);
+			
+			if (pte && (*pte & PAGE_PRESENT)) {
+				if ((*pte & PAGE_AROUND) && (*pte & PAGE_ACCESSED))
+					stats.around_hits++;
+				free_page(page);
+			}
+		}
+		break;
+	}
+}
+
+int
+vm_madvise(u32 start, u32 len, u32 advice)
+{
+	u32 end = start + len;
+	
+	if (start % PAGE_SIZE != 0 || end < start || advice > MADV_DONTNEED)
+		return -1;
+	
+	align(end, PAGE_SIZE);
+	
+	/* The whole range must be mapped */
+	for (u32 addr = start; addr < end; ) {
+		struct vm_area *area = vm_find_area(addr);
+		if (!area)
+			return -1;
+		addr = area->end;
+	}
+	
+	for (u32 addr = start; addr < end; ) {
+		struct vm_area *area = vm_find_area(addr);
+		
+		/* Advice stored in the area flags must not leak out of the range */
+		if (advice <= MADV_SEQUENTIAL) {
+			area = split_area(area, addr);
+			if (!area || !split_area(area, end))
+				return -1;
+		}
+		
+		u32 to = end < area->end ? end : area->end;
+		
+		advise_area(area, addr, to, advice);
+		addr = to;
+	}
+	
+	return 0;
+}
+
+int
+vm_set_uffd(u32 start, u32 len, int uffd)
+{
+	u32 end = start + len;
+	
+	for (u32 addr = start; addr < end; ) {
+		struct vm_area *area = vm_find_area(addr);
+		
+		area = area ? split_area(area, addr) : 0;
+		if (!area || !split_area(area, end))
+			return -1;
+		
+		area->flags |= VM_UFFD;
+		area->uffd = uffd;
+		addr = area->end;
+	}
+	
+	return 0;
+}
+
+void
+vm_get_fault_stats(struct vm_fault_stats *out)
+{
+	if (current_task) {
+		for (struct vm_area *a = current_task->vm_areas; a; a = a->next)
+			scan_around_hits(a);
+	}
+	
+	*out = stats;
+}
+
+void
+vm_dump_fault_stats()
+{
+	struct vm_fault_stats s;
+	
+	vm_get_fault_stats(&s);
+	
+	kprintf("page faults: %d, fault-around windows: %d\n", s.faults,
+			s.around_windows);
+	kprintf("    neighbours mapped: %d, accessed: %d\n", s.around_pages,
+			s.around_hits);
+}
@@ -0,0 +1,174 @@
+#include <alien/memory/vmalloc.h>
+#include <alien/memory/paging.h>
+#include <alien/memory/kmalloc.h>
+#include <alien/kernel.h>
+
+/* An allocated range, the list is sorted by address */
+struct vm_range {
+	u32              addr;
+	u32              size;		/* Mapped bytes, the guard page excluded */
+	u8               io;		/* Device memory, the frames aren't ours */
+	struct vm_range *next;
+};
+
+static struct vm_range *ranges = 0;
+
+void
+vmalloc_init()
+{
+	reserve_kernel_range(VMALLOC_START, VMALLOC_END);
+}
+
+/*
+ * Find the first hole of @size bytes plus a guard page and insert a range
+ * descriptor for it.
+ */
+static struct vm_range *
+range_alloc(u32 size)
+{
+	struct vm_range **link = &ranges;
+	u32 addr = VMALLOC_START;
+	
+	while (*link && (*link)->addr - addr < size + PAGE_SIZE) {
+		addr = (*link)->addr + (*link)->size + PAGE_SIZE;
+		link = &(*link)->next;
+	}
+	
+	if (!*link && (VMALLOC_END - addr < size + PAGE_SIZE || addr < VMALLOC_START))
+		return (struct vm_range *) 0;
+	
+	struct vm_range *range = (struct vm_range *) kmalloc(sizeof(struct vm_range));
+	if (!range)
+		return (struct vm_range *) 0;
+	
+	range->addr = addr;
+	range->size = size;
+	range->io = 0;
+	range->next = *link;
+	*link = range;
+	
+	return range;
+}
+
+static void
+range_free(struct vm_range *range)
+{
+	struct vm_range **link = &ranges;
+	
+	while (*link != range) {
+		link = &(*link)->next;
+	}
+	
+	*link = range->next;
+	kfree(range);
+}
+
+static void
+unmap_range(u32 addr, u32 end)
+{
+	for (; addr < end; addr += PAGE_SIZE) {
+		free_page(addr);
+	}
+}
+
+void *
+vmalloc(u32 size)
+{
+	if (size == 0 || size > VMALLOC_END - VMALLOC_START)
+		return 0;
+	
+	size = updiv(size, PAGE_SIZE) * PAGE_SIZE;
+	
+	struct vm_range *range = range_alloc(size);
+	if (!range)
+		return 0;
+	
+	for (u32 page = range->addr; page < range->addr + size; page += PAGE_SIZE) {
+		u32 frame = alloc_frame();
+		
+		if (!map_at(page, frame, PAGE_RW)) {
+			if (frame)
+				free_frame(frame);
+			unmap_range(range->addr, page);
+			range_free(range);
+			return 0;
+		}
+	}
+	
+	return (void *) range->addr;
+}
+
+static struct vm_range *
+range_find(u32 addr)
+{
+	struct vm_range *range = ranges;
+	
+	while (range && range->addr != addr) {
+		range = range->next;
+	}
+	
+	return range;
+}
+
+void
+vfree(void *addr)
+{
+	struct vm_range *range = range_find((u32) addr);
+	
+	if (!range || range->io) {
+		if (addr)
+			kprintf("[ERROR] vfree: 0x%x wasn't allocated\n", (u32) addr);
+		return;
+	}
+	
+	unmap_range(range->addr, range->addr + range->size);
+	range_free(range);
+}
+
+void *
+ioremap(u32 phys, u32 size)
+{
+	u32 offset = phys % PAGE_SIZE;
+	
+	if (size == 0 || size > VMALLOC_END - VMALLOC_START - offset)
+		return 0;
+	
+	size = updiv(size + offset, PAGE_SIZE) * PAGE_SIZE;
+	phys -= offset;
+	
+	struct vm_range *range = range_alloc(size);
+	if (!range)
+		return 0;
+	
+	range->io = 1;
+	
+	for (u32 i = 0; i < size; i += PAGE_SIZE) {
+		if (!map_at(range->addr + i, phys + i, PAGE_RW | PAGE_PCD | PAGE_PWT)) {
+			while (i > 0) {
+				i -= PAGE_SIZE;
+				unmap(range->addr + i);
+			}
+			range_free(range);
+			return 0;
+		}
+	}
+	
+	return (void *) (range->addr + offset);
+}
+
+void
+iounmap(void *addr)
+{
+	struct vm_range *range = range_find((u32) addr & ~(PAGE_SIZE - 1));
+	
+	if (!range || !range->io) {
+		kprintf("[ERROR] iounmap: 0x%x wasn't mapped\n", (u32) addr);
+		return;
+	}
+	
+	for (u32 i = 0; i < range->size; i += PAGE_SIZE) {
+		unmap(range->addr + i);
+	}
+	
+	range_free(range);
+}